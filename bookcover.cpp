@@ -0,0 +1,69 @@
+#include "bookcover.h"
+#include "readerform.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+
+namespace
+{
+	const int kThumbnailHeight = 96;//列表图标48像素，留出高分屏的余量
+	const QString kThumbnailSuffix = ".png";
+
+	QString coverDirectory()
+	{
+		return QDir::currentPath() + "/covers/";
+	}
+}
+
+QString bookCover::thumbnailPath(const QString& bookId)
+{
+	//标识中的冒号不能出现在Windows文件名里
+	return coverDirectory() + QString(bookId).replace(':', '_') + kThumbnailSuffix;
+}
+
+bool bookCover::extract(readerform& parser, const QString& bookId)
+{
+	const QString coverPath = parser.getCoverImagePath();
+	if (coverPath.isEmpty())
+	{
+		return false;
+	}
+
+	QImage cover;
+	if (!cover.loadFromData(parser.getResourceByPath(coverPath)))
+	{
+		return false;
+	}
+	if (cover.height() > kThumbnailHeight)
+	{
+		cover = cover.scaledToHeight(kThumbnailHeight, Qt::SmoothTransformation);
+	}
+
+	QDir().mkpath(coverDirectory());
+	return cover.save(thumbnailPath(bookId));
+}
+
+void bookCover::remove(const QString& bookId)
+{
+	QFile::remove(thumbnailPath(bookId));
+}
+
+QHash<QString, QString> bookCover::scanThumbnails()
+{
+	QHash<QString, QString> thumbnails;
+	const QDir dir(coverDirectory());
+	const QStringList fileNames = dir.entryList({ "*" + kThumbnailSuffix }, QDir::Files);
+	thumbnails.reserve(fileNames.size());
+	for (const QString& fileName : fileNames)
+	{
+		QString bookId = QFileInfo(fileName).completeBaseName();
+		const qsizetype separator = bookId.indexOf('_');//只有方案前缀后的第一个冒号被替换
+		if (separator > 0)
+		{
+			bookId[separator] = ':';
+		}
+		thumbnails.insert(bookId, dir.filePath(fileName));
+	}
+	return thumbnails;
+}
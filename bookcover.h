@@ -0,0 +1,21 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+
+class readerform;
+
+//书籍封面的缩略图，导入时从epub中取出并缩小，保存在程序目录的covers下，以书籍标识命名
+//书库列表直接用缩略图作图标，不必再打开epub
+class bookCover
+{
+public:
+	//一本书的缩略图路径
+	static QString thumbnailPath(const QString& bookId);
+	//从已打开的epub中取出封面，缩小后保存，可以在工作线程中调用
+	static bool extract(readerform& parser, const QString& bookId);
+	//删除一本书的缩略图，书籍从书库删除或换了标识时调用
+	static void remove(const QString& bookId);
+	//已有缩略图的书：书籍标识->缩略图路径，只列一次目录
+	static QHash<QString, QString> scanThumbnails();
+};
@@ -0,0 +1,118 @@
+#include "bookidentity.h"
+#include "epubmappedarchive.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QXmlStreamReader>
+#include <QtEndian>
+#include <QtConcurrent/QtConcurrentMap>
+
+namespace
+{
+	const qint64 kSampleSize = 64 * 1024;
+
+	//container.xml中第一个rootfile的路径
+	QString findOpfPath(const QByteArray& containerData)
+	{
+		QXmlStreamReader xml(containerData);
+		while (!xml.atEnd() && !xml.hasError())
+		{
+			xml.readNext();
+			if (xml.isStartElement() && xml.name() == QLatin1String("rootfile"))
+			{
+				return xml.attributes().value("full-path").toString();
+			}
+		}
+		return QString();
+	}
+
+	//opf中package的unique-identifier所指的dc:identifier，没有时取第一个dc:identifier
+	QString findUniqueIdentifier(const QByteArray& opfData)
+	{
+		QXmlStreamReader xml(opfData);
+		QString uniqueId;
+		QString firstIdentifier;
+		while (!xml.atEnd() && !xml.hasError())
+		{
+			xml.readNext();
+			if (xml.isStartElement())
+			{
+				if (xml.name() == QLatin1String("package"))
+				{
+					uniqueId = xml.attributes().value("unique-identifier").toString();
+				}
+				else if (xml.name() == QLatin1String("identifier"))
+				{
+					const bool isUnique = !uniqueId.isEmpty() && xml.attributes().value("id") == uniqueId;
+					const QString text = xml.readElementText(QXmlStreamReader::SkipChildElements).trimmed();
+					if (isUnique)
+					{
+						return text;
+					}
+					if (firstIdentifier.isEmpty())
+					{
+						firstIdentifier = text;
+					}
+				}
+			}
+			else if (xml.isEndElement() && xml.name() == QLatin1String("metadata"))
+			{
+				break;//标识符只会出现在metadata中
+			}
+		}
+		return firstIdentifier;
+	}
+}
+
+QString bookIdentity::compute(const QString& filePath)
+{
+	epubMappedArchive archive;
+	if (!archive.open(filePath))
+	{
+		return computeSampled(filePath);
+	}
+
+	//opf的标识符区分内容相同但出版方不同的书，读不到时只用中央目录
+	const QString opfPath = findOpfPath(archive.read("META-INF/container.xml"));
+	if (!opfPath.isEmpty())
+	{
+		return compute(archive.centralDirectory(), findUniqueIdentifier(archive.read(opfPath)));
+	}
+	return "zip:" + QString::fromLatin1(QCryptographicHash::hash(archive.centralDirectory(), QCryptographicHash::Md5).toHex());
+}
+
+QString bookIdentity::compute(const QByteArray& centralDirectory, const QString& uniqueId)
+{
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	hash.addData(centralDirectory);
+	hash.addData(QByteArrayView("\0", 1));
+	hash.addData(uniqueId.toUtf8());
+	return "zip:" + QString::fromLatin1(hash.result().toHex());
+}
+
+QString bookIdentity::computeSampled(const QString& filePath)
+{
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		return "path:" + QString::fromLatin1(QCryptographicHash::hash(filePath.toUtf8(), QCryptographicHash::Md5).toHex());
+	}
+
+	const qint64 size = file.size();
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	char sizeBytes[8];
+	qToLittleEndian(quint64(size), sizeBytes);
+	hash.addData(QByteArrayView(sizeBytes, 8));
+
+	hash.addData(file.read(kSampleSize));
+	if (size > kSampleSize)
+	{
+		file.seek(qMax(kSampleSize, size - kSampleSize));//小文件首尾重叠的部分不重复读
+		hash.addData(file.read(kSampleSize));
+	}
+	return "md5:" + QString::fromLatin1(hash.result().toHex());
+}
+
+QStringList bookIdentity::computeAll(const QStringList& filePaths)
+{
+	return QtConcurrent::blockingMapped<QStringList>(filePaths, &bookIdentity::compute);
+}
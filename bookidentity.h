@@ -0,0 +1,22 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+//书籍的稳定标识，与文件路径无关，移动或重命名文件后不变
+//书库中每本书的记录以它为键，分类只引用它；导入时用它发现重复的书和被移动的文件
+class bookIdentity
+{
+public:
+	//计算标识：zip中央目录和opf中唯一标识符(dc:identifier)的MD5
+	//中央目录在文件末尾，记录了每个文件的名称、CRC和大小，只读这一小段就相当于整本书内容的哈希
+	//不是有效的zip时退回到computeSampled；要单独打开文件，只在没有打开书籍时使用(迁移旧书库等)
+	static QString compute(const QString& filePath);
+	//由已读出的中央目录和唯一标识符计算，结果与compute(filePath)相同，已经打开书籍时不必再读一次文件
+	static QString compute(const QByteArray& centralDirectory, const QString& uniqueId);
+	//旧的标识：文件大小和首尾各64KB内容的MD5，文件无法读取时退回到路径的哈希
+	//早先保存的书籍以它为键，导入时用来匹配这些书
+	static QString computeSampled(const QString& filePath);
+	//在线程池中并行计算多本书的标识，顺序与filePaths一致
+	static QStringList computeAll(const QStringList& filePaths);
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QStringList>
+#include <QTime>
+#include <QDateTime>
+
+/*-------------------*/
+//书签
+struct bookMark
+{
+    QString chapterId;//章节id
+    QString chapterTitle;//章节名称
+    int pageInChapter;//章节内页码
+};
+/*-------------------*/
+
+// 表示电子书的数据结构
+struct BookInfo {
+    QString bookId;          // 稳定标识，书库记录以它为键，见bookIdentity
+    QString filePath;        // 文件路径
+    QString title;           // 书籍标题
+    QStringList authors;     // 作者，来自opf的dc:creator
+    QStringList subjects;    // 主题，来自opf的dc:subject
+    QTime totalReadTime;     // 总阅读时间
+    bool isFavorite;         // 是否是收藏
+    QDateTime lastReadTime;  // 最后阅读时间
+    QList<QString> categories; // 所属分类
+    //QMap<int, QString> bookmarks; // 书签列表，键为页码，值为书签描述
+    QList<bookMark> BookMarks;//书签列表，包含id和页码
+    
+    bookMark lastReadRecord;
+    bool detailLoaded;       // 书签和阅读记录是否已从书库读出，启动时只读基本信息
+
+    BookInfo() : isFavorite(false), detailLoaded(true) {
+        totalReadTime = QTime(0, 0);
+    }
+};
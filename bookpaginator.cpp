@@ -0,0 +1,259 @@
+#include "bookpaginator.h"
+#include "chapterdocument.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDebug>
+#include <algorithm>
+
+void bookPageMap::reset(const QStringList& chapterIds)
+{
+	zChapterIds = chapterIds;
+	zPageCounts.fill(-1, chapterIds.size());
+	rebuildOffsets();
+}
+
+void bookPageMap::clear()
+{
+	reset(QStringList());
+}
+
+void bookPageMap::setPageCount(int chapterIndex, int pageCount)
+{
+	if (chapterIndex < 0 || chapterIndex >= zPageCounts.size() || zPageCounts[chapterIndex] == pageCount)
+	{
+		return;
+	}
+	zPageCounts[chapterIndex] = pageCount;
+	rebuildOffsets();
+}
+
+int bookPageMap::pageCount(int chapterIndex) const
+{
+	return chapterIndex >= 0 && chapterIndex < zPageCounts.size() ? zPageCounts.at(chapterIndex) : -1;
+}
+
+int bookPageMap::chapterCount() const
+{
+	return zChapterIds.size();
+}
+
+bool bookPageMap::isComplete() const
+{
+	return !zChapterIds.isEmpty() && zUnknownChapters == 0;
+}
+
+int bookPageMap::totalPages() const
+{
+	return zKnownPages;
+}
+
+int bookPageMap::bookPage(int chapterIndex, int pageInChapter) const
+{
+	if (chapterIndex < 0 || chapterIndex >= zFirstPages.size() || zFirstPages.at(chapterIndex) < 0)
+	{
+		return 0;
+	}
+	int pages = zPageCounts.at(chapterIndex);
+	if (pages > 0)
+	{
+		pageInChapter = qBound(1, pageInChapter, pages);
+	}
+	return zFirstPages.at(chapterIndex) + qMax(1, pageInChapter);
+}
+
+bool bookPageMap::locate(int bookPage, int& chapterIndex, int& pageInChapter) const
+{
+	if (!isComplete() || bookPage < 1 || bookPage > zKnownPages)
+	{
+		return false;
+	}
+
+	//zFirstPages单调不减，二分查找最后一个起始页不超过bookPage-1的章节
+	auto it = std::upper_bound(zFirstPages.constBegin(), zFirstPages.constEnd(), bookPage - 1);
+	const int index = int(it - zFirstPages.constBegin()) - 1;
+	if (index < 0)
+	{
+		return false;
+	}
+
+	chapterIndex = index;
+	pageInChapter = bookPage - zFirstPages.at(index);
+	return true;
+}
+
+void bookPageMap::rebuildOffsets()
+{
+	zFirstPages.resize(zPageCounts.size());
+	zKnownPages = 0;
+	zUnknownChapters = 0;
+	for (int i = 0; i < zPageCounts.size(); ++i)
+	{
+		zFirstPages[i] = zUnknownChapters == 0 ? zKnownPages : -1;
+		if (zPageCounts.at(i) < 0)
+		{
+			++zUnknownChapters;
+		}
+		else
+		{
+			zKnownPages += zPageCounts.at(i);
+		}
+	}
+}
+
+bookPaginator::bookPaginator(QObject *parent)
+	: QObject(parent), zWatcher(nullptr)
+{}
+
+bookPaginator::~bookPaginator()
+{
+	cancel();
+}
+
+void bookPaginator::paginate(const epubReadSnapshot& snapshot, const QStringList& spineIds, const QFont& font, const QSizeF& pageSize)
+{
+	if (snapshot.epubFilePath == zEpubFilePath && spineIds == zSpineIds && font == zFont && pageSize == zPageSize)
+	{
+		return;//参数未变，已有的页码表仍然有效
+	}
+
+	cancel();
+	if (snapshot.epubFilePath.isEmpty() || spineIds.isEmpty() || pageSize.isEmpty())
+	{
+		return;
+	}
+
+	if (!zCache || zCache->bookFilePath() != snapshot.epubFilePath)//换书时保存旧书的缓存
+	{
+		if (zCache)
+		{
+			zCache->save();
+		}
+		zCache = std::make_shared<paginationCache>(snapshot.epubFilePath);
+	}
+
+	zEpubFilePath = snapshot.epubFilePath;
+	zSpineIds = spineIds;
+	zFont = font;
+	zPageSize = pageSize;
+	zPageMap.reset(spineIds);
+
+	std::shared_ptr<paginationCache> cache = zCache;
+	QFuture<int> future = QtConcurrent::run([snapshot, spineIds, font, pageSize, cache](QPromise<int>& promise) {
+		epubEntryReader reader(snapshot);
+		for (int i = 0; i < spineIds.size(); ++i)
+		{
+			if (promise.isCanceled())
+			{
+				return;
+			}
+
+			const QString html = QString::fromUtf8(reader.readContentById(spineIds.at(i)));
+			const QByteArray key = paginationCache::makeKey(paginationCache::contentHash(html), font, pageSize);
+			int pageCount = cache->pageCount(key);
+			if (pageCount < 0)//缓存中没有才排版
+			{
+				pageCount = layoutChapter(reader, snapshot, spineIds.at(i), html, font, pageSize);
+				cache->insert(key, pageCount);
+			}
+			promise.addResult(pageCount, i);
+		}
+		});
+
+	QFutureWatcher<int>* watcher = new QFutureWatcher<int>(this);
+	connect(watcher, &QFutureWatcherBase::resultReadyAt, this, [this, watcher](int index) {
+		if (watcher != zWatcher)
+		{
+			return;
+		}
+		//界面已经排过的章节不覆盖
+		if (zPageMap.pageCount(index) < 0)
+		{
+			zPageMap.setPageCount(index, watcher->resultAt(index));
+		}
+		emit chapterPaginated(index, zPageMap.pageCount(index));
+		});
+	connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+		watcher->deleteLater();
+		if (watcher != zWatcher)//已被取消或被新的任务取代
+		{
+			return;
+		}
+		zWatcher = nullptr;
+		zCache->save();
+		emit finished();
+		});
+
+	zWatcher = watcher;
+	watcher->setFuture(future);
+}
+
+void bookPaginator::cancel()
+{
+	if (zWatcher)
+	{
+		zWatcher->cancel();//工作线程在下一章开始前检查到取消后退出
+		zWatcher = nullptr;
+	}
+	if (zCache)//已经排好的章节留到下次使用
+	{
+		zCache->save();
+	}
+	zEpubFilePath.clear();
+	zSpineIds.clear();
+	zPageSize = QSizeF();
+	zPageMap.clear();
+}
+
+bool bookPaginator::isRunning() const
+{
+	return zWatcher != nullptr;
+}
+
+const bookPageMap& bookPaginator::pageMap() const
+{
+	return zPageMap;
+}
+
+void bookPaginator::setChapterPageCount(int chapterIndex, int pageCount, const QByteArray& contentHash)
+{
+	if (zCache && !zEpubFilePath.isEmpty() && !contentHash.isEmpty())
+	{
+		zCache->insert(paginationCache::makeKey(contentHash, zFont, zPageSize), pageCount);
+	}
+	if (chapterIndex < 0 || chapterIndex >= zPageMap.chapterCount() || zPageMap.pageCount(chapterIndex) == pageCount)
+	{
+		return;
+	}
+	zPageMap.setPageCount(chapterIndex, pageCount);
+	emit chapterPaginated(chapterIndex, pageCount);
+}
+
+int bookPaginator::cachedPageCount(const QByteArray& contentHash) const
+{
+	if (!zCache || zEpubFilePath.isEmpty())
+	{
+		return -1;
+	}
+	return zCache->pageCount(paginationCache::makeKey(contentHash, zFont, zPageSize));
+}
+
+int bookPaginator::layoutChapter(epubEntryReader& reader, const epubReadSnapshot& snapshot, const QString& itemId, const QString& html, const QFont& font, const QSizeF& pageSize)
+{
+	if (html.isEmpty())
+	{
+		return 1;//界面上空章节也显示一页
+	}
+
+	//与界面使用同样的文档类型，图片参与排版，页数才能对得上
+	chapterDocument document([&reader](const QString& filePathInZip) {
+		return reader.read(filePathInZip);
+		}, nullptr);
+	auto it = snapshot.manifestItem.constFind(itemId);
+	if (it != snapshot.manifestItem.constEnd())
+	{
+		document.setChapterPath(it->path);
+	}
+	document.setDefaultFont(font);
+	document.setPageSize(pageSize);
+	document.setHtml(html);
+	return qMax(1, document.pageCount());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QFont>
+#include <QSizeF>
+#include <QFutureWatcher>
+#include <memory>
+#include "readerform.h"
+#include "paginationcache.h"
+
+//全书页码表：按spine顺序记录每章的页数和在全书中的起始页
+class bookPageMap
+{
+public:
+	void reset(const QStringList& chapterIds);
+	void clear();
+	//设置某章的页数，-1表示未知
+	void setPageCount(int chapterIndex, int pageCount);
+	int pageCount(int chapterIndex) const;
+	int chapterCount() const;
+	//所有章节都已分页
+	bool isComplete() const;
+	//已知的全书总页数，未完成时只统计已分页的章节
+	int totalPages() const;
+	//章节内页码(从1开始)->全书页码(从1开始)，所在章节之前有未知页数时返回0
+	int bookPage(int chapterIndex, int pageInChapter) const;
+	//全书页码->章节下标和章节内页码，失败返回false
+	bool locate(int bookPage, int& chapterIndex, int& pageInChapter) const;
+
+private:
+	void rebuildOffsets();
+
+	QStringList zChapterIds;
+	QList<int> zPageCounts;//每章页数，-1为未知
+	QList<int> zFirstPages;//每章在全书中的起始页(从0开始)，前面有未知章节时为-1
+	int zKnownPages = 0;
+	int zUnknownChapters = 0;
+};
+
+//在后台把整本书按当前字体和页面大小分页，得到全书页码表
+class bookPaginator  : public QObject
+{
+	Q_OBJECT
+
+public:
+	bookPaginator(QObject *parent);
+	~bookPaginator();
+	//参数与上次不同时重新分页，之前的任务会被取消
+	void paginate(const epubReadSnapshot& snapshot, const QStringList& spineIds, const QFont& font, const QSizeF& pageSize);
+	//取消并清空页码表
+	void cancel();
+	//是否正在分页
+	bool isRunning() const;
+	//获取页码表
+	const bookPageMap& pageMap() const;
+	//界面上实际排版得到的章节页数，以它为准，同时写入分页缓存
+	void setChapterPageCount(int chapterIndex, int pageCount, const QByteArray& contentHash);
+	//按当前字体和页面大小查询缓存的章节页数，没有记录时返回-1
+	int cachedPageCount(const QByteArray& contentHash) const;
+
+signals:
+	//某一章分页完成
+	void chapterPaginated(int chapterIndex, int pageCount);
+	//全书分页完成
+	void finished();
+
+private:
+	//对单章排版并返回页数，在工作线程中调用
+	static int layoutChapter(epubEntryReader& reader, const epubReadSnapshot& snapshot, const QString& itemId, const QString& html, const QFont& font, const QSizeF& pageSize);
+
+	QFutureWatcher<int>* zWatcher;//当前的分页任务
+	bookPageMap zPageMap;
+	std::shared_ptr<paginationCache> zCache;//当前书籍的分页缓存，与工作线程共享
+
+	QString zEpubFilePath;//以下为上次分页使用的参数
+	QStringList zSpineIds;
+	QFont zFont;
+	QSizeF zPageSize;
+};
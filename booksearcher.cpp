@@ -0,0 +1,152 @@
+#include "booksearcher.h"
+#include "chapterdocument.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QAbstractTextDocumentLayout>
+#include <QTextBlock>
+#include <QTextLayout>
+
+namespace
+{
+	const int kSnippetContext = 20;//命中位置前后各取的字数
+}
+
+bookSearcher::bookSearcher(QObject *parent)
+	: QObject(parent), zWatcher(nullptr), zHitCount(0)
+{}
+
+bookSearcher::~bookSearcher()
+{
+	cancel();
+}
+
+void bookSearcher::search(const epubReadSnapshot& snapshot, const QStringList& spineIds, const QString& text, const QFont& font, const QSizeF& pageSize)
+{
+	cancel();
+	zHitCount = 0;
+	if (text.isEmpty() || spineIds.isEmpty())
+	{
+		emit finished(0);
+		return;
+	}
+
+	QFuture<bookSearchHit> future = QtConcurrent::run([snapshot, spineIds, text, font, pageSize](QPromise<bookSearchHit>& promise) {
+		promise.setProgressRange(0, int(spineIds.size()));
+		epubEntryReader reader(snapshot);
+		int hitCount = 0;
+		for (int i = 0; i < spineIds.size(); ++i)
+		{
+			if (promise.isCanceled() || hitCount >= maxHits)
+			{
+				return;
+			}
+			searchChapter(promise, hitCount, reader, snapshot, i, spineIds.at(i), text, font, pageSize);
+			promise.setProgressValue(i + 1);
+		}
+		});
+
+	QFutureWatcher<bookSearchHit>* watcher = new QFutureWatcher<bookSearchHit>(this);
+	connect(watcher, &QFutureWatcherBase::resultsReadyAt, this, [this, watcher](int begin, int end) {
+		if (watcher != zWatcher)
+		{
+			return;
+		}
+		for (int i = begin; i < end; ++i)
+		{
+			++zHitCount;
+			emit hitFound(watcher->resultAt(i));
+		}
+		});
+	connect(watcher, &QFutureWatcherBase::progressValueChanged, this, [this, watcher](int value) {
+		if (watcher == zWatcher)
+		{
+			emit progress(value, watcher->progressMaximum());
+		}
+		});
+	connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+		watcher->deleteLater();
+		if (watcher != zWatcher)//已被取消或被新的搜索取代
+		{
+			return;
+		}
+		zWatcher = nullptr;
+		emit finished(zHitCount);
+		});
+
+	zWatcher = watcher;
+	watcher->setFuture(future);
+}
+
+void bookSearcher::cancel()
+{
+	if (zWatcher)
+	{
+		zWatcher->cancel();//工作线程在下一章开始前检查到取消后退出
+		zWatcher = nullptr;
+	}
+}
+
+bool bookSearcher::isRunning() const
+{
+	return zWatcher != nullptr;
+}
+
+void bookSearcher::searchChapter(QPromise<bookSearchHit>& promise, int& hitCount, epubEntryReader& reader, const epubReadSnapshot& snapshot,
+	int chapterIndex, const QString& itemId, const QString& text, const QFont& font, const QSizeF& pageSize)
+{
+	const QString html = QString::fromUtf8(reader.readContentById(itemId));
+	if (html.isEmpty())
+	{
+		return;
+	}
+
+	//与界面相同的排版，才能算出命中在第几页
+	chapterDocument document([&reader](const QString& filePathInZip) {
+		return reader.read(filePathInZip);
+		}, nullptr);
+	auto it = snapshot.manifestItem.constFind(itemId);
+	if (it != snapshot.manifestItem.constEnd())
+	{
+		document.setChapterPath(it->path);
+	}
+	document.setDefaultFont(font);
+	document.setPageSize(pageSize);
+	document.setHtml(html);
+
+	//纯文本中的下标与文档位置一一对应
+	const QString plainText = document.toPlainText();
+	QAbstractTextDocumentLayout* layout = document.documentLayout();
+	const qreal pageHeight = pageSize.height();
+
+	qsizetype position = plainText.indexOf(text, 0, Qt::CaseInsensitive);
+	while (position >= 0)
+	{
+		if (promise.isCanceled() || hitCount >= maxHits)
+		{
+			return;
+		}
+
+		bookSearchHit hit;
+		hit.chapterId = itemId;
+		hit.chapterIndex = chapterIndex;
+
+		const QTextBlock block = document.findBlock(int(position));
+		if (block.isValid() && pageHeight > 0)
+		{
+			//只排版到命中所在的块
+			qreal y = layout->blockBoundingRect(block).top();
+			const QTextLine line = block.layout()->lineForTextPosition(int(position - block.position()));
+			if (line.isValid())
+			{
+				y += line.y();
+			}
+			hit.pageInChapter = int(y / pageHeight) + 1;
+		}
+
+		const qsizetype snippetStart = qMax<qsizetype>(0, position - kSnippetContext);
+		hit.snippet = plainText.mid(snippetStart, position - snippetStart + text.size() + kSnippetContext).simplified();
+
+		promise.addResult(hit);
+		++hitCount;
+		position = plainText.indexOf(text, position + text.size(), Qt::CaseInsensitive);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QFont>
+#include <QSizeF>
+#include <QFutureWatcher>
+#include "readerform.h"
+
+//书内搜索的一条结果
+struct bookSearchHit
+{
+	QString chapterId;//章节id
+	int chapterIndex = -1;//在spine中的下标
+	int pageInChapter = 1;//章节内页码
+	QString snippet;//命中位置附近的文字
+};
+
+//在后台逐章提取正文并搜索，结果边找边送回界面线程
+class bookSearcher  : public QObject
+{
+	Q_OBJECT
+
+public:
+	static constexpr int maxHits = 500;//结果上限，避免常见字刷满列表
+
+	bookSearcher(QObject *parent);
+	~bookSearcher();
+	//开始搜索，之前的搜索会被取消；字体和页面大小用来计算命中所在的页
+	void search(const epubReadSnapshot& snapshot, const QStringList& spineIds, const QString& text, const QFont& font, const QSizeF& pageSize);
+	//取消当前搜索
+	void cancel();
+	//是否正在搜索
+	bool isRunning() const;
+
+signals:
+	//找到一条结果
+	void hitFound(const bookSearchHit& hit);
+	//已搜索的章节数
+	void progress(int searchedChapters, int totalChapters);
+	//搜索结束
+	void finished(int hitCount);
+
+private:
+	//在一章中搜索，在工作线程中调用
+	static void searchChapter(QPromise<bookSearchHit>& promise, int& hitCount, epubEntryReader& reader, const epubReadSnapshot& snapshot,
+		int chapterIndex, const QString& itemId, const QString& text, const QFont& font, const QSizeF& pageSize);
+
+	QFutureWatcher<bookSearchHit>* zWatcher;//当前的搜索任务
+	int zHitCount;
+};
@@ -0,0 +1,41 @@
+#include "chapterdocument.h"
+#include "readerform.h"
+#include <QImage>
+#include <QDebug>
+
+chapterDocument::chapterDocument(const epubResourceReader& resourceReader, QObject* parent)
+	: QTextDocument(parent), zResourceReader(resourceReader)
+{}
+
+chapterDocument::~chapterDocument()
+{}
+
+void chapterDocument::setChapterPath(const QString& chapterPathInZip)
+{
+	const int slashPos = chapterPathInZip.lastIndexOf('/');
+	zChapterDir = slashPos == -1 ? QString() : chapterPathInZip.left(slashPos);
+}
+
+QVariant chapterDocument::loadResource(int type, const QUrl& name)
+{
+	if (type != QTextDocument::ImageResource || !zResourceReader || !name.isRelative())
+	{
+		return QTextDocument::loadResource(type, name);
+	}
+
+	const QString pathInZip = readerform::normalHref(zChapterDir, name.toString(QUrl::FullyDecoded));
+	//存储的图片拿到的是映射区域的切片，直接在上面解码，不复制压缩数据
+	const QByteArray data = zResourceReader(pathInZip);
+	if (data.isEmpty())
+	{
+		return QTextDocument::loadResource(type, name);
+	}
+
+	QImage image = QImage::fromData(data);
+	if (image.isNull())
+	{
+		qWarning() << "could not decode image" << pathInZip;
+		return QVariant();
+	}
+	return image;//文档缓存的是解码后的图片，不引用切片
+}
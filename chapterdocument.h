@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QTextDocument>
+#include <QString>
+#include <QUrl>
+#include <QVariant>
+#include <functional>
+
+//按zip内路径读取资源
+using epubResourceReader = std::function<QByteArray(const QString& filePathInZip)>;
+
+//章节文档，图片等资源直接从epub中读取
+class chapterDocument : public QTextDocument
+{
+	Q_OBJECT
+
+public:
+	chapterDocument(const epubResourceReader& resourceReader, QObject* parent);
+	~chapterDocument();
+	//设置当前章节在zip中的路径，相对路径的资源以它所在的目录为基准
+	void setChapterPath(const QString& chapterPathInZip);
+
+protected:
+	QVariant loadResource(int type, const QUrl& name) override;
+
+private:
+	epubResourceReader zResourceReader;
+	QString zChapterDir;//章节所在目录
+};
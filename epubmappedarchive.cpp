@@ -0,0 +1,411 @@
+#include "epubmappedarchive.h"
+#include <QtEndian>
+#include <QDebug>
+#include <QStringDecoder>
+#include <limits>
+#include <zlib.h>
+
+namespace
+{
+	const quint32 kEndOfCentralDirSig = 0x06054b50;
+	const quint32 kZip64EndOfCentralDirSig = 0x06064b50;
+	const quint32 kZip64LocatorSig = 0x07064b50;
+	const quint32 kCentralDirHeaderSig = 0x02014b50;
+	const quint32 kLocalHeaderSig = 0x04034b50;
+
+	const qint64 kEndOfCentralDirSize = 22;
+	const qint64 kCentralDirHeaderSize = 46;
+	const qint64 kLocalHeaderSize = 30;
+	const qint64 kMaxCommentSize = 0xFFFF;
+	const quint16 kUtf8NameFlag = 0x0800;//通用标志位第11位：文件名为UTF-8
+	const quint64 kMaxInflateRatio = 1032;//deflate的压缩比上限约为1032:1
+	const quint64 kInflateSlack = 1024;//很小的压缩数据允许的额外余量
+
+	//未标记UTF-8的文件名：合法的UTF-8直接使用，否则与QuaZip一样按本地编码解码
+	QString decodeEntryName(const uchar* name, quint16 nameLength, quint16 flags)
+	{
+		const QByteArrayView bytes(name, nameLength);
+		if (flags & kUtf8NameFlag)
+		{
+			return QString::fromUtf8(bytes);
+		}
+
+		QStringDecoder decoder(QStringDecoder::Utf8, QStringDecoder::Flag::Stateless);
+		const QString decoded = decoder(bytes);
+		return decoder.hasError() ? QString::fromLocal8Bit(bytes) : decoded;
+	}
+
+	quint16 readU16(const uchar* p)
+	{
+		return qFromLittleEndian<quint16>(p);
+	}
+
+	quint32 readU32(const uchar* p)
+	{
+		return qFromLittleEndian<quint32>(p);
+	}
+
+	quint64 readU64(const uchar* p)
+	{
+		return qFromLittleEndian<quint64>(p);
+	}
+}
+
+epubMappedArchive::epubMappedArchive()
+	: zData(nullptr), zSize(0), zCentralDirOffset(0), zCentralDirSize(0)
+{}
+
+epubMappedArchive::~epubMappedArchive()
+{
+	close();
+}
+
+bool epubMappedArchive::open(const QString& filePath)
+{
+	close();
+
+	zFile.setFileName(filePath);
+	if (!zFile.open(QIODevice::ReadOnly))
+	{
+		zLastError = QString("could not open %1: %2").arg(filePath, zFile.errorString());
+		return false;
+	}
+
+	zSize = zFile.size();
+	zData = zFile.map(0, zSize);
+	if (!zData)
+	{
+		zLastError = QString("could not map %1: %2").arg(filePath, zFile.errorString());
+		close();
+		return false;
+	}
+
+	if (!parseCentralDirectory())
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void epubMappedArchive::close()
+{
+	if (zData)
+	{
+		zFile.unmap(const_cast<uchar*>(zData));
+		zData = nullptr;
+	}
+	if (zFile.isOpen())
+	{
+		zFile.close();
+	}
+	zSize = 0;
+	zCentralDirOffset = 0;
+	zCentralDirSize = 0;
+	zEntries.clear();
+	zEntryIndex.clear();
+	zEntryIndexFolded.clear();
+}
+
+bool epubMappedArchive::isOpen() const
+{
+	return zData != nullptr;
+}
+
+int epubMappedArchive::entryCount() const
+{
+	return zEntries.size();
+}
+
+QByteArray epubMappedArchive::centralDirectory() const
+{
+	if (!zData)
+	{
+		return QByteArray();
+	}
+	return QByteArray::fromRawData(reinterpret_cast<const char*>(zData + zCentralDirOffset), qsizetype(zCentralDirSize));
+}
+
+QString epubMappedArchive::getLastError() const
+{
+	return zLastError;
+}
+
+bool epubMappedArchive::parseCentralDirectory()
+{
+	if (zSize < kEndOfCentralDirSize)
+	{
+		zLastError = QString("file is too small to be a zip archive");
+		return false;
+	}
+
+	//从文件末尾向前查找中央目录结束记录，最多跨过一个最大长度的注释
+	qint64 eocdPos = -1;
+	const qint64 searchStart = zSize - kEndOfCentralDirSize;
+	const qint64 searchEnd = qMax<qint64>(0, searchStart - kMaxCommentSize);
+	for (qint64 pos = searchStart; pos >= searchEnd; --pos)
+	{
+		if (readU32(zData + pos) == kEndOfCentralDirSig)
+		{
+			eocdPos = pos;
+			break;
+		}
+	}
+
+	if (eocdPos < 0)
+	{
+		zLastError = QString("end of central directory not found");
+		return false;
+	}
+
+	const uchar* eocd = zData + eocdPos;
+	quint64 entryCount = readU16(eocd + 10);
+	quint64 dirSize = readU32(eocd + 12);
+	quint64 dirOffset = readU32(eocd + 16);
+
+	//zip64：真实的值记录在zip64结束记录里
+	if (entryCount == 0xFFFF || dirSize == 0xFFFFFFFF || dirOffset == 0xFFFFFFFF)
+	{
+		const qint64 locatorPos = eocdPos - 20;
+		if (locatorPos < 0 || readU32(zData + locatorPos) != kZip64LocatorSig)
+		{
+			zLastError = QString("zip64 locator not found");
+			return false;
+		}
+
+		//文件中的64位值可能是伪造的，边界检查都写成减法，避免相加溢出后绕过检查
+		const quint64 zip64EocdPos = readU64(zData + locatorPos + 8);
+		if (zip64EocdPos > quint64(zSize) || quint64(zSize) - zip64EocdPos < 56 || readU32(zData + zip64EocdPos) != kZip64EndOfCentralDirSig)
+		{
+			zLastError = QString("zip64 end of central directory is invalid");
+			return false;
+		}
+
+		const uchar* zip64Eocd = zData + zip64EocdPos;
+		entryCount = readU64(zip64Eocd + 32);
+		dirSize = readU64(zip64Eocd + 40);
+		dirOffset = readU64(zip64Eocd + 48);
+	}
+
+	if (dirOffset > quint64(zSize) || dirSize > quint64(zSize) - dirOffset)
+	{
+		zLastError = QString("central directory lies outside the file");
+		return false;
+	}
+	zCentralDirOffset = dirOffset;
+	zCentralDirSize = dirSize;
+
+	zEntries.reserve(qsizetype(qMin<quint64>(entryCount, dirSize / kCentralDirHeaderSize)));
+	zEntryIndex.reserve(zEntries.capacity());
+	zEntryIndexFolded.reserve(zEntries.capacity());
+
+	const uchar* p = zData + dirOffset;
+	const uchar* dirEnd = p + dirSize;
+	for (quint64 i = 0; i < entryCount; ++i)
+	{
+		if (p + kCentralDirHeaderSize > dirEnd || readU32(p) != kCentralDirHeaderSig)
+		{
+			zLastError = QString("central directory entry %1 is corrupt").arg(i);
+			return false;
+		}
+
+		const quint16 nameLength = readU16(p + 28);
+		const quint16 extraLength = readU16(p + 30);
+		const quint16 commentLength = readU16(p + 32);
+		const uchar* name = p + kCentralDirHeaderSize;
+		const uchar* extra = name + nameLength;
+		const uchar* next = extra + extraLength + commentLength;
+		if (next > dirEnd)
+		{
+			zLastError = QString("central directory entry %1 is truncated").arg(i);
+			return false;
+		}
+
+		mappedZipEntry entry;
+		entry.flags = readU16(p + 8);
+		entry.method = readU16(p + 10);
+		entry.compressedSize = readU32(p + 20);
+		entry.uncompressedSize = readU32(p + 24);
+		entry.localHeaderOffset = readU32(p + 42);
+		entry.name = decodeEntryName(name, nameLength, entry.flags);
+
+		//zip64扩展字段，只包含在头部中被置为0xFFFFFFFF的值，顺序固定
+		const uchar* field = extra;
+		const uchar* extraEnd = extra + extraLength;
+		while (field + 4 <= extraEnd)
+		{
+			const quint16 fieldId = readU16(field);
+			const quint16 fieldSize = readU16(field + 2);
+			const uchar* value = field + 4;
+			const uchar* valueEnd = value + fieldSize;
+			if (valueEnd > extraEnd)
+			{
+				break;
+			}
+			if (fieldId == 0x0001)
+			{
+				if (entry.uncompressedSize == 0xFFFFFFFF && value + 8 <= valueEnd)
+				{
+					entry.uncompressedSize = readU64(value);
+					value += 8;
+				}
+				if (entry.compressedSize == 0xFFFFFFFF && value + 8 <= valueEnd)
+				{
+					entry.compressedSize = readU64(value);
+					value += 8;
+				}
+				if (entry.localHeaderOffset == 0xFFFFFFFF && value + 8 <= valueEnd)
+				{
+					entry.localHeaderOffset = readU64(value);
+				}
+				break;
+			}
+			field = valueEnd;
+		}
+
+		const int entryIndex = zEntries.size();
+		zEntries.append(entry);
+		zEntryIndex.insert(entry.name, entryIndex);
+
+		const QString folded = entry.name.toCaseFolded();
+		if (!zEntryIndexFolded.contains(folded))//同名时取第一个，与QuaZip一致
+		{
+			zEntryIndexFolded.insert(folded, entryIndex);
+		}
+
+		p = next;
+	}
+
+	return true;
+}
+
+const mappedZipEntry* epubMappedArchive::findEntry(const QString& filePathInZip) const
+{
+	auto it = zEntryIndex.constFind(filePathInZip);
+	if (it == zEntryIndex.constEnd())
+	{
+		it = zEntryIndexFolded.constFind(filePathInZip.toCaseFolded());
+		if (it == zEntryIndexFolded.constEnd())
+		{
+			return nullptr;
+		}
+	}
+	return &zEntries.at(it.value());
+}
+
+bool epubMappedArchive::contains(const QString& filePathInZip) const
+{
+	return findEntry(filePathInZip) != nullptr;
+}
+
+const uchar* epubMappedArchive::entryData(const mappedZipEntry& entry) const
+{
+	if (entry.localHeaderOffset > quint64(zSize) || quint64(zSize) - entry.localHeaderOffset < quint64(kLocalHeaderSize))
+	{
+		return nullptr;
+	}
+
+	const uchar* header = zData + entry.localHeaderOffset;
+	if (readU32(header) != kLocalHeaderSig)
+	{
+		return nullptr;
+	}
+
+	//本地头的文件名和扩展字段长度可能与中央目录不同，必须以本地头为准
+	const quint64 dataOffset = entry.localHeaderOffset + kLocalHeaderSize + readU16(header + 26) + readU16(header + 28);
+	if (dataOffset > quint64(zSize) || entry.compressedSize > quint64(zSize) - dataOffset)
+	{
+		return nullptr;
+	}
+	return zData + dataOffset;
+}
+
+QByteArray epubMappedArchive::read(const QString& filePathInZip) const
+{
+	if (!zData)
+	{
+		return QByteArray();
+	}
+
+	const mappedZipEntry* entry = findEntry(filePathInZip);
+	if (!entry)
+	{
+		return QByteArray();
+	}
+
+	if (entry->flags & 0x1)
+	{
+		qWarning() << "encrypted zip entry is not supported:" << entry->name;
+		return QByteArray();
+	}
+
+	const uchar* data = entryData(*entry);
+	if (!data)
+	{
+		qWarning() << "zip entry data is out of range:" << entry->name;
+		return QByteArray();
+	}
+
+	if (entry->method == 0)//存储：直接引用映射区域
+	{
+		return QByteArray::fromRawData(reinterpret_cast<const char*>(data), qsizetype(entry->compressedSize));
+	}
+
+	if (entry->method == 8)
+	{
+		return inflateEntry(data, *entry);
+	}
+
+	qWarning() << "unsupported compression method" << entry->method << "for" << entry->name;
+	return QByteArray();
+}
+
+QByteArray epubMappedArchive::inflateEntry(const uchar* data, const mappedZipEntry& entry) const
+{
+	const quint64 maxChunk = std::numeric_limits<uInt>::max();
+	if (entry.compressedSize > maxChunk || entry.uncompressedSize > maxChunk)
+	{
+		qWarning() << "zip entry is too large to inflate in one pass:" << entry.name;
+		return QByteArray();
+	}
+
+	if (entry.uncompressedSize == 0)
+	{
+		return QByteArray();
+	}
+
+	//中央目录中的大小不可信，超过deflate可能达到的压缩比时不按它分配内存
+	if (entry.uncompressedSize > entry.compressedSize * kMaxInflateRatio + kInflateSlack)
+	{
+		qWarning() << "zip entry declares an impossible uncompressed size:" << entry.name << entry.uncompressedSize;
+		return QByteArray();
+	}
+
+	QByteArray out;
+	out.resize(qsizetype(entry.uncompressedSize));
+
+	z_stream stream = {};
+	stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+	stream.avail_in = uInt(entry.compressedSize);
+	stream.next_out = reinterpret_cast<Bytef*>(out.data());
+	stream.avail_out = uInt(out.size());
+
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)//zip中是不带zlib头的原始deflate数据
+	{
+		qWarning() << "inflateInit2 failed for" << entry.name;
+		return QByteArray();
+	}
+
+	const int result = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+
+	if (result != Z_STREAM_END)
+	{
+		qWarning() << "inflate failed for" << entry.name << "code:" << result;
+		return QByteArray();
+	}
+
+	out.resize(qsizetype(stream.total_out));
+	return out;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QByteArray>
+#include <QFile>
+
+//中央目录中的一项
+struct mappedZipEntry
+{
+	QString name;
+	quint16 flags = 0;//通用标志位
+	quint16 method = 0;//0为存储，8为deflate
+	quint64 compressedSize = 0;
+	quint64 uncompressedSize = 0;
+	quint64 localHeaderOffset = 0;//本地文件头在文件中的偏移
+};
+
+//把整个epub映射到内存，直接在映射区域上查找和解压，不再逐个文件seek/read
+//open之后只读，read可以在多个线程同时调用
+class epubMappedArchive
+{
+public:
+	epubMappedArchive();
+	~epubMappedArchive();
+
+	//映射并解析中央目录
+	bool open(const QString& filePath);
+	//解除映射
+	void close();
+	bool isOpen() const;
+	//是否包含某个文件(先精确匹配，再忽略大小写)
+	bool contains(const QString& filePathInZip) const;
+	//读取文件内容，存储(method 0)的文件直接返回映射区域的切片，不复制，切片在close之前有效
+	QByteArray read(const QString& filePathInZip) const;
+	//zip中的文件数
+	int entryCount() const;
+	//中央目录的原始字节，是映射区域的切片，在close之前有效
+	//其中记录了每个文件的名称、CRC和大小，可以代替全文哈希作为内容的指纹
+	QByteArray centralDirectory() const;
+	//获取错误信息
+	QString getLastError() const;
+
+private:
+	Q_DISABLE_COPY(epubMappedArchive)
+
+	bool parseCentralDirectory();
+	const mappedZipEntry* findEntry(const QString& filePathInZip) const;
+	//定位文件数据在映射区域中的起始位置
+	const uchar* entryData(const mappedZipEntry& entry) const;
+	QByteArray inflateEntry(const uchar* data, const mappedZipEntry& entry) const;
+
+	QFile zFile;
+	const uchar* zData;//映射区域
+	qint64 zSize;//映射大小
+	quint64 zCentralDirOffset;//中央目录在文件中的偏移
+	quint64 zCentralDirSize;//中央目录的长度
+
+	QList<mappedZipEntry> zEntries;
+	QHash<QString, int> zEntryIndex;//路径->zEntries下标
+	QHash<QString, int> zEntryIndexFolded;//大小写折叠后的路径->zEntries下标
+
+	QString zLastError;
+};
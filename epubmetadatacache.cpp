@@ -0,0 +1,194 @@
+#include "epubmetadatacache.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+
+namespace
+{
+	const quint32 kCacheMagic = 0x45504D43;//"EPMC"
+	const quint16 kCacheVersion = 5;//2：manifest项带zip内路径；3：目录保留层级；4：epub3导航文档；5：元数据带unique_identifier_id
+
+	//元数据中作者、标识符等是QList<QVariantMap>，按静态类型写出，读入时不依赖元类型的注册
+	enum metadataValueKind : quint8
+	{
+		PLAIN_VALUE,
+		MAP_LIST_VALUE
+	};
+
+	void writeMetadata(QDataStream& out, const QVariantMap& metadata)
+	{
+		out << quint32(metadata.size());
+		for (auto it = metadata.cbegin(); it != metadata.cend(); ++it)
+		{
+			out << it.key();
+			if (it.value().metaType() == QMetaType::fromType<QList<QVariantMap>>())
+			{
+				out << quint8(MAP_LIST_VALUE) << it.value().value<QList<QVariantMap>>();
+			}
+			else
+			{
+				out << quint8(PLAIN_VALUE) << it.value();
+			}
+		}
+	}
+
+	void readMetadata(QDataStream& in, QVariantMap& metadata)
+	{
+		quint32 count = 0;
+		in >> count;
+		for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+		{
+			QString key;
+			quint8 kind = PLAIN_VALUE;
+			in >> key >> kind;
+			if (kind == MAP_LIST_VALUE)
+			{
+				QList<QVariantMap> maps;
+				in >> maps;
+				metadata.insert(key, QVariant::fromValue(maps));
+			}
+			else
+			{
+				QVariant value;
+				in >> value;
+				metadata.insert(key, value);
+			}
+		}
+	}
+}
+
+QString epubMetadataCache::cachePath(const QString& epubFilePath)
+{
+	//按书籍路径的哈希命名，与分页缓存一致
+	const QByteArray pathHash = QCryptographicHash::hash(epubFilePath.toUtf8(), QCryptographicHash::Md5).toHex();
+	return QDir::currentPath() + "/opfcache/" + QString::fromLatin1(pathHash) + ".meta";
+}
+
+bool epubMetadataCache::load(const QString& epubFilePath, const QByteArray& centralDirHash, epubMetadataSnapshot& snapshot)
+{
+	if (centralDirHash.isEmpty())
+	{
+		return false;
+	}
+	QFile file(cachePath(epubFilePath));
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_6_0);
+	quint32 magic = 0;
+	quint16 version = 0;
+	qint64 size = -1;
+	qint64 modified = 0;
+	QByteArray storedHash;
+	in >> magic >> version;
+	if (magic != kCacheMagic || version != kCacheVersion)//格式不符时当作没有缓存
+	{
+		return false;
+	}
+	in >> size >> modified >> storedHash;
+	const QFileInfo info(epubFilePath);
+	if (size != info.size() || modified != info.lastModified().toMSecsSinceEpoch() || storedHash != centralDirHash)
+	{
+		return false;//书籍已改动
+	}
+
+	epubMetadataSnapshot loaded;
+	quint32 manifestCount = 0;
+	in >> loaded.opfFilePath >> loaded.opfBasePath >> loaded.ncxItemId >> manifestCount;
+	for (quint32 i = 0; i < manifestCount && in.status() == QDataStream::Ok; ++i)
+	{
+		epubManifestItem item;
+		in >> item.id >> item.href >> item.mediaType >> item.fallback >> item.properties >> item.path;
+		loaded.manifestItem.insert(item.id, item);
+	}
+	quint32 spineCount = 0;
+	in >> spineCount;
+	for (quint32 i = 0; i < spineCount && in.status() == QDataStream::Ok; ++i)
+	{
+		SpineItem item;
+		in >> item.idref >> item.linear;
+		loaded.spineItem.append(item);
+	}
+	quint32 tocCount = 0;
+	in >> tocCount;
+	for (quint32 i = 0; i < tocCount && in.status() == QDataStream::Ok; ++i)
+	{
+		epubTocEntry entry;
+		qint32 parent = -1;
+		qint32 depth = 0;
+		in >> entry.title >> entry.path >> entry.fragment >> parent >> depth;
+		if (parent < -1 || parent >= qint32(i))//上一级总在前面
+		{
+			in.setStatus(QDataStream::ReadCorruptData);
+			break;
+		}
+		entry.parent = parent;
+		entry.depth = depth;
+		loaded.tocEntries.append(entry);
+	}
+	readMetadata(in, loaded.metadata);
+
+	if (in.status() != QDataStream::Ok || loaded.opfFilePath.isEmpty())
+	{
+		qWarning() << "epub metadata cache is corrupt:" << file.fileName();
+		return false;
+	}
+	snapshot = std::move(loaded);
+	return true;
+}
+
+bool epubMetadataCache::save(const QString& epubFilePath, const QByteArray& centralDirHash, const epubMetadataSnapshot& snapshot)
+{
+	if (centralDirHash.isEmpty())
+	{
+		return false;
+	}
+	const QString filePath = cachePath(epubFilePath);
+	QDir().mkpath(QFileInfo(filePath).absolutePath());
+	QSaveFile file(filePath);//先写临时文件再替换，中途退出不会留下半个缓存
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		qWarning() << "could not write epub metadata cache" << filePath << file.errorString();
+		return false;
+	}
+
+	const QFileInfo info(epubFilePath);
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_6_0);
+	out << kCacheMagic << kCacheVersion << info.size() << info.lastModified().toMSecsSinceEpoch() << centralDirHash;
+	out << snapshot.opfFilePath << snapshot.opfBasePath << snapshot.ncxItemId << quint32(snapshot.manifestItem.size());
+	for (const epubManifestItem& item : snapshot.manifestItem)
+	{
+		out << item.id << item.href << item.mediaType << item.fallback << item.properties << item.path;
+	}
+	out << quint32(snapshot.spineItem.size());
+	for (const SpineItem& item : snapshot.spineItem)
+	{
+		out << item.idref << item.linear;
+	}
+	out << quint32(snapshot.tocEntries.size());
+	for (const epubTocEntry& entry : snapshot.tocEntries)
+	{
+		out << entry.title << entry.path << entry.fragment << qint32(entry.parent) << qint32(entry.depth);
+	}
+	writeMetadata(out, snapshot.metadata);
+
+	if (!file.commit())
+	{
+		qWarning() << "could not commit epub metadata cache" << filePath << file.errorString();
+		return false;
+	}
+	return true;
+}
+
+void epubMetadataCache::remove(const QString& epubFilePath)
+{
+	QFile::remove(cachePath(epubFilePath));
+}
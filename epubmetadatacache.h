@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+#include <QList>
+#include <QVariantMap>
+#include "readerform.h"
+
+//打开书籍时从container.xml、opf和ncx解析出的全部内容
+struct epubMetadataSnapshot
+{
+	QString opfFilePath;
+	QString opfBasePath;
+	QMap<QString, epubManifestItem> manifestItem;
+	QList<SpineItem> spineItem;
+	QString ncxItemId;
+	QList<epubTocEntry> tocEntries;
+	QVariantMap metadata;
+};
+
+//每本书的解析结果缓存，保存在程序目录的opfcache下，按书籍路径的哈希命名
+//以文件大小、修改时间和中央目录的哈希判断是否有效，再次打开同一本书时不再解析任何xml
+//只读写各自的文件，可以在多个线程同时使用
+class epubMetadataCache
+{
+public:
+	//读出缓存，文件已改动或缓存不存在时返回false
+	static bool load(const QString& epubFilePath, const QByteArray& centralDirHash, epubMetadataSnapshot& snapshot);
+	//写入缓存
+	static bool save(const QString& epubFilePath, const QByteArray& centralDirHash, const epubMetadataSnapshot& snapshot);
+	//删除一本书的缓存，书籍从书库删除或移动位置时调用
+	static void remove(const QString& epubFilePath);
+
+private:
+	static QString cachePath(const QString& epubFilePath);
+};
@@ -0,0 +1,98 @@
+#include "epubtableofcontents.h"
+#include "readerform.h"
+#include <QFileInfo>
+#include <QDebug>
+
+epubTableOfContents::epubTableOfContents()
+	: zChildren(1)
+{}
+
+epubTableOfContents::epubTableOfContents(const QList<epubTocEntry>& entries, const QList<SpineItem>& spine, const QMap<QString, epubManifestItem>& manifest)
+	: zEntries(entries), zChildren(entries.size() + 1)
+{
+	QHash<QString, QString> idByPath;//zip内路径->manifest id
+	idByPath.reserve(manifest.size());
+	for (const epubManifestItem& item : manifest)
+	{
+		idByPath.insert(item.path, item.id);
+	}
+
+	QHash<QString, QString> titleByPath;//章节文件->第一个指向它的目录项的标题
+	zEntryChapterIds.reserve(zEntries.size());
+	for (int i = 0; i < zEntries.size(); ++i)
+	{
+		const epubTocEntry& entry = zEntries.at(i);
+		zChildren[entry.parent + 1].append(i);
+		zEntryChapterIds.append(idByPath.value(entry.path));
+		if (!entry.title.isEmpty() && !entry.path.isEmpty() && !titleByPath.contains(entry.path))
+		{
+			titleByPath.insert(entry.path, entry.title);
+		}
+	}
+
+	for (const SpineItem& spineItem : spine)
+	{
+		if (!spineItem.linear)
+		{
+			continue;
+		}
+
+		QString title;
+		auto item = manifest.constFind(spineItem.idref);
+		if (item == manifest.constEnd())
+		{
+			qWarning() << "Spine item idref " << spineItem.idref << " not found in manifest.";
+			title = spineItem.idref + " not found.";
+		}
+		else
+		{
+			title = titleByPath.value(item->path);
+			if (title.isEmpty())//目录中没有此章，则使用文件名
+			{
+				title = QFileInfo(item->href).fileName();
+			}
+			if (title.isEmpty())//没有文件名，则使用id
+			{
+				title = item->id;
+			}
+		}
+
+		zTitleById.insert(spineItem.idref, title);
+		zTitleMap.insert(spineItem.idref, title);
+		if (!zIdByTitle.contains(title))
+		{
+			zIdByTitle.insert(title, spineItem.idref);
+		}
+	}
+}
+
+const QList<epubTocEntry>& epubTableOfContents::entries() const
+{
+	return zEntries;
+}
+
+const QList<int>& epubTableOfContents::children(int parent) const
+{
+	static const QList<int> none;
+	return parent + 1 >= 0 && parent + 1 < zChildren.size() ? zChildren.at(parent + 1) : none;
+}
+
+QString epubTableOfContents::entryChapterId(int entry) const
+{
+	return zEntryChapterIds.value(entry);
+}
+
+QString epubTableOfContents::chapterTitle(const QString& chapterId) const
+{
+	return zTitleById.value(chapterId);
+}
+
+QString epubTableOfContents::chapterId(const QString& title) const
+{
+	return zIdByTitle.value(title);
+}
+
+const QMap<QString, QString>& epubTableOfContents::chapterTitles() const
+{
+	return zTitleMap;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QMap>
+
+struct epubManifestItem;
+struct SpineItem;
+
+//目录中的一项
+struct epubTocEntry
+{
+	QString title;
+	QString path;//指向的zip内路径，不含锚点
+	QString fragment;//锚点，没有时为空
+	int parent = -1;//上一级在目录项中的下标，顶层为-1
+	int depth = 0;//层级，顶层为0
+};
+
+//书籍的目录，打开书籍时建立一次，之后只读，可以在线程之间共享
+//保留ncx的层级，章节id和标题之间的查找都是常数时间
+class epubTableOfContents
+{
+public:
+	epubTableOfContents();
+	//由先序排列的目录项和spine建立
+	//章节标题取第一个指向该章节文件的目录项，没有时用文件名
+	epubTableOfContents(const QList<epubTocEntry>& entries, const QList<SpineItem>& spine, const QMap<QString, epubManifestItem>& manifest);
+	//全部目录项，先序排列
+	const QList<epubTocEntry>& entries() const;
+	//下一级目录项的下标，parent为-1时返回顶层
+	const QList<int>& children(int parent) const;
+	//目录项指向的章节id，指向的文件不在manifest中时为空
+	QString entryChapterId(int entry) const;
+	//spine线性部分中章节的标题，不在其中时为空
+	QString chapterTitle(const QString& chapterId) const;
+	//标题对应的章节id，同名时取第一个
+	QString chapterId(const QString& title) const;
+	//章节id->标题
+	const QMap<QString, QString>& chapterTitles() const;
+
+private:
+	QList<epubTocEntry> zEntries;
+	QList<QList<int>> zChildren;//下标+1->下一级，第0项是顶层
+	QStringList zEntryChapterIds;//目录项->章节id
+	QHash<QString, QString> zTitleById;//章节id->标题
+	QHash<QString, QString> zIdByTitle;//标题->章节id
+	QMap<QString, QString> zTitleMap;//章节id->标题，按id排序，供原来的接口使用
+};
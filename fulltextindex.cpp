@@ -0,0 +1,1031 @@
+#include "fulltextindex.h"
+#include "readerform.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QTextDocument>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSet>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const quint32 kSegmentMagic = 0x47535446;//"FTSG"
+	const quint16 kSegmentVersion = 1;
+	const qint64 kHeaderSize = 40;
+	const qint64 kTermSize = 16;//词条：键(8)，第一个位置的下标(4)，位置个数(4)
+	const qint64 kPostingSize = 8;//位置：章节下标(4)，章节内的词序(4)
+	const int kLabelLength = 40;//章节标签的最大字数
+
+	//BM25参数
+	const double kTermSaturation = 1.2;
+	const double kLengthWeight = 0.75;
+
+	const quint64 kFnvBasis = 14695981039346656037ULL;
+	const quint64 kFnvPrime = 1099511628211ULL;
+
+	quint32 readU32(const uchar* p)
+	{
+		return qFromLittleEndian<quint32>(p);
+	}
+
+	quint64 readU64(const uchar* p)
+	{
+		return qFromLittleEndian<quint64>(p);
+	}
+
+	void appendU16(QByteArray& out, quint16 value)
+	{
+		char bytes[2];
+		qToLittleEndian(value, bytes);
+		out.append(bytes, 2);
+	}
+
+	void appendU32(QByteArray& out, quint32 value)
+	{
+		char bytes[4];
+		qToLittleEndian(value, bytes);
+		out.append(bytes, 4);
+	}
+
+	void appendU64(QByteArray& out, quint64 value)
+	{
+		char bytes[8];
+		qToLittleEndian(value, bytes);
+		out.append(bytes, 8);
+	}
+
+	//长度(2字节)+utf8，超长部分截掉
+	void appendShortString(QByteArray& out, const QString& text)
+	{
+		QByteArray utf8 = text.toUtf8();
+		if (utf8.size() > 0xFFFF)
+		{
+			utf8 = text.left(0xFFFF / 4).toUtf8();
+		}
+		appendU16(out, quint16(utf8.size()));
+		out.append(utf8);
+	}
+
+	bool isCjk(char32_t c)
+	{
+		switch (QChar::script(c))
+		{
+		case QChar::Script_Han:
+		case QChar::Script_Hiragana:
+		case QChar::Script_Katakana:
+		case QChar::Script_Hangul:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	quint64 hashChar(quint64 hash, char32_t c)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			hash ^= (c >> (i * 8)) & 0xFF;
+			hash *= kFnvPrime;
+		}
+		return hash;
+	}
+
+	enum tokenizeMode
+	{
+		INDEX_TOKENS,//建立索引：中日韩文字输出单字和两字
+		QUERY_TOKENS //查询：连续两个以上的中日韩文字只输出两字，单独一个字输出单字
+	};
+
+	//切分文本，sink(键, 词序)；返回词序总数，即文本长度
+	template <typename Sink>
+	quint32 tokenize(const QString& text, tokenizeMode mode, Sink sink)
+	{
+		const QList<uint> codes = text.toUcs4();
+		const qsizetype count = codes.size();
+		quint32 position = 0;
+		qsizetype i = 0;
+		while (i < count)
+		{
+			const char32_t c = codes.at(i);
+			if (isCjk(c))
+			{
+				qsizetype end = i + 1;
+				while (end < count && isCjk(codes.at(end)))
+				{
+					++end;
+				}
+				const bool single = end - i == 1;
+				for (qsizetype k = i; k < end; ++k, ++position)
+				{
+					const quint64 unigram = hashChar(kFnvBasis, codes.at(k));
+					if (mode == INDEX_TOKENS || single)
+					{
+						sink(unigram, position);
+					}
+					if (k + 1 < end)
+					{
+						sink(hashChar(unigram, codes.at(k + 1)), position);
+					}
+				}
+				i = end;
+			}
+			else if (QChar::isLetterOrNumber(c))
+			{
+				quint64 word = kFnvBasis;
+				while (i < count && QChar::isLetterOrNumber(codes.at(i)) && !isCjk(codes.at(i)))
+				{
+					word = hashChar(word, QChar::toCaseFolded(char32_t(codes.at(i))));
+					++i;
+				}
+				sink(word, position++);
+			}
+			else
+			{
+				++i;
+			}
+		}
+		return position;
+	}
+
+	//章节开头第一行非空文字
+	QString chapterLabel(const QString& plainText)
+	{
+		const QStringList lines = plainText.split(QChar('\n'));
+		for (const QString& line : lines)
+		{
+			const QString label = line.simplified();
+			if (!label.isEmpty())
+			{
+				return label.left(kLabelLength);
+			}
+		}
+		return QString();
+	}
+
+	//一个词条在段中的全部位置，按(章节, 词序)排序
+	struct postingSpan
+	{
+		const uchar* data = nullptr;
+		quint32 count = 0;
+
+		quint32 chapterAt(quint32 i) const
+		{
+			return readU32(data + i * kPostingSize);
+		}
+
+		quint32 positionAt(quint32 i) const
+		{
+			return readU32(data + i * kPostingSize + 4);
+		}
+
+		//第一个章节不小于chapter的下标
+		quint32 lowerBound(quint32 chapter) const
+		{
+			quint32 low = 0;
+			quint32 high = count;
+			while (low < high)
+			{
+				const quint32 mid = low + (high - low) / 2;
+				if (chapterAt(mid) < chapter)
+				{
+					low = mid + 1;
+				}
+				else
+				{
+					high = mid;
+				}
+			}
+			return low;
+		}
+
+		//在[begin, end)中查找词序
+		bool containsPosition(quint32 begin, quint32 end, quint32 position) const
+		{
+			while (begin < end)
+			{
+				const quint32 mid = begin + (end - begin) / 2;
+				const quint32 value = positionAt(mid);
+				if (value == position)
+				{
+					return true;
+				}
+				if (value < position)
+				{
+					begin = mid + 1;
+				}
+				else
+				{
+					end = mid;
+				}
+			}
+			return false;
+		}
+
+		//包含该词条的章节数
+		quint32 chapterCount() const
+		{
+			quint32 chapters = 0;
+			quint32 i = 0;
+			while (i < count)
+			{
+				++chapters;
+				i = lowerBound(chapterAt(i) + 1);
+			}
+			return chapters;
+		}
+	};
+
+	//书籍文件的大小和修改时间是否与建立索引时一致
+	bool isSourceUnchanged(const QFileInfo& info, const fullTextSource& source)
+	{
+		return source.size >= 0 && info.size() == source.size && info.lastModified().toMSecsSinceEpoch() == source.modified;
+	}
+
+	//只读段文件的头部和书籍路径，不映射整个文件
+	bool readSegmentSource(const QString& filePath, fullTextSource& source)
+	{
+		QFile file(filePath);
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			return false;
+		}
+		const QByteArray header = file.read(kHeaderSize + 4);
+		if (header.size() < kHeaderSize + 4)
+		{
+			return false;
+		}
+		const uchar* p = reinterpret_cast<const uchar*>(header.constData());
+		if (readU32(p) != kSegmentMagic || qFromLittleEndian<quint16>(p + 4) != kSegmentVersion)
+		{
+			return false;
+		}
+		const quint32 pathLength = readU32(p + kHeaderSize);
+		const QByteArray path = file.read(pathLength);
+		if (path.size() != qsizetype(pathLength))
+		{
+			return false;
+		}
+		source.bookPath = QString::fromUtf8(path);
+		source.size = qint64(readU64(p + 8));
+		source.modified = qint64(readU64(p + 16));
+		return true;
+	}
+
+	//本进程的临时文件名带进程号，扫描时只删除以前的进程留下的
+	QString temporarySuffix()
+	{
+		return QString(".%1.").arg(QCoreApplication::applicationPid());
+	}
+}
+
+//后台同步的结果
+struct fullTextSyncResult
+{
+	QList<fullTextSource> indexed;//有段文件的书
+	QStringList stalePaths;//需要建立索引的书
+	QStringList orphanFiles;//不属于书库的段文件
+};
+
+//映射后的一本书的段文件，只读
+class fullTextSegment
+{
+public:
+	struct chapterEntry
+	{
+		QString id;
+		QString label;
+		quint32 tokenCount = 0;
+	};
+
+	fullTextSegment()
+		: zData(nullptr), zSize(0), zTerms(nullptr), zTermCount(0), zPostings(nullptr), zPostingCount(0)
+	{}
+
+	~fullTextSegment()
+	{
+		if (zData)
+		{
+			zFile.unmap(const_cast<uchar*>(zData));
+		}
+	}
+
+	bool open(const QString& filePath)
+	{
+		zFile.setFileName(filePath);
+		if (!zFile.open(QIODevice::ReadOnly))
+		{
+			qWarning() << "could not open full text segment" << filePath << zFile.errorString();
+			return false;
+		}
+		zSize = zFile.size();
+		if (zSize < kHeaderSize)
+		{
+			return false;
+		}
+		zData = zFile.map(0, zSize);
+		if (!zData)
+		{
+			qWarning() << "could not map full text segment" << filePath << zFile.errorString();
+			return false;
+		}
+		if (readU32(zData) != kSegmentMagic || qFromLittleEndian<quint16>(zData + 4) != kSegmentVersion)//格式不符时当作没有索引
+		{
+			return false;
+		}
+
+		sourceSize = qint64(readU64(zData + 8));
+		sourceModified = qint64(readU64(zData + 16));
+		const quint32 chapterCount = readU32(zData + 24);
+		zTermCount = readU32(zData + 28);
+		const quint64 termsOffset = readU64(zData + 32);
+
+		//书籍路径和章节信息在头部之后，数量不多，直接读出来
+		const uchar* p = zData + kHeaderSize;
+		const uchar* stringsEnd = zData + qMin<quint64>(termsOffset, quint64(zSize));
+		auto readString = [&p, stringsEnd](int lengthBytes, QString& text) {
+			if (p + lengthBytes > stringsEnd)
+			{
+				return false;
+			}
+			const quint32 length = lengthBytes == 4 ? readU32(p) : qFromLittleEndian<quint16>(p);
+			p += lengthBytes;
+			if (p + length > stringsEnd)
+			{
+				return false;
+			}
+			text = QString::fromUtf8(reinterpret_cast<const char*>(p), length);
+			p += length;
+			return true;
+			};
+
+		if (!readString(4, bookPath))
+		{
+			return false;
+		}
+		chapters.reserve(qMin<qsizetype>(chapterCount, (stringsEnd - p) / 8));
+		totalTokens = 0;
+		for (quint32 i = 0; i < chapterCount; ++i)
+		{
+			chapterEntry chapter;
+			if (!readString(2, chapter.id) || !readString(2, chapter.label) || p + 4 > stringsEnd)
+			{
+				return false;
+			}
+			chapter.tokenCount = readU32(p);
+			p += 4;
+			totalTokens += chapter.tokenCount;
+			chapters.append(chapter);
+		}
+
+		const quint64 postingsOffset = termsOffset + quint64(zTermCount) * kTermSize;
+		if (postingsOffset > quint64(zSize))
+		{
+			return false;
+		}
+		zTerms = zData + termsOffset;
+		zPostings = zData + postingsOffset;
+		zPostingCount = quint32((quint64(zSize) - postingsOffset) / kPostingSize);
+		return true;
+	}
+
+	//查找词条，没有时返回空区间
+	postingSpan find(quint64 key) const
+	{
+		quint32 low = 0;
+		quint32 high = zTermCount;
+		while (low < high)
+		{
+			const quint32 mid = low + (high - low) / 2;
+			const uchar* term = zTerms + mid * kTermSize;
+			const quint64 value = readU64(term);
+			if (value == key)
+			{
+				const quint32 first = readU32(term + 8);
+				const quint32 count = readU32(term + 12);
+				postingSpan span;
+				if (first <= zPostingCount && count <= zPostingCount - first)
+				{
+					span.data = zPostings + quint64(first) * kPostingSize;
+					span.count = count;
+				}
+				return span;
+			}
+			if (value < key)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		return postingSpan();
+	}
+
+	QString bookPath;
+	qint64 sourceSize = -1;//建立索引时书籍文件的大小
+	qint64 sourceModified = 0;//建立索引时书籍文件的修改时间
+	QList<chapterEntry> chapters;
+	quint64 totalTokens = 0;
+
+private:
+	Q_DISABLE_COPY(fullTextSegment)
+
+	QFile zFile;
+	const uchar* zData;
+	qint64 zSize;
+	const uchar* zTerms;//词条表，按键排序
+	quint32 zTermCount;
+	const uchar* zPostings;//位置表
+	quint32 zPostingCount;
+};
+
+fullTextIndex::fullTextIndex(QObject *parent)
+	: QObject(parent), zWatcher(nullptr), zSyncWatcher(nullptr), zBuildSerial(0)
+{}
+
+fullTextIndex::~fullTextIndex()
+{
+	if (zWatcher)
+	{
+		zWatcher->cancel();//工作线程在下一章开始前退出，并删除写了一半的文件
+		zWatcher = nullptr;
+	}
+	if (zSyncWatcher)
+	{
+		zSyncWatcher->cancel();
+		zSyncWatcher = nullptr;
+	}
+}
+
+QString fullTextIndex::segmentPath(const QString& bookPath)
+{
+	//按书籍路径的哈希命名，与分页缓存一致
+	const QByteArray pathHash = QCryptographicHash::hash(bookPath.toUtf8(), QCryptographicHash::Md5).toHex();
+	return QDir::currentPath() + "/fulltext/" + QString::fromLatin1(pathHash) + ".seg";
+}
+
+std::shared_ptr<fullTextSegment> fullTextIndex::segment(const QString& bookPath) const
+{
+	std::shared_ptr<fullTextSegment> opened = zSegments.value(bookPath);
+	if (!opened && zIndexed.contains(bookPath))
+	{
+		opened = std::make_shared<fullTextSegment>();
+		if (!opened->open(segmentPath(bookPath)) || opened->bookPath != bookPath)
+		{
+			return nullptr;//打不开的段不参与查询
+		}
+		zSegments.insert(bookPath, opened);
+	}
+	return opened;
+}
+
+void fullTextIndex::syncLibrary(const QStringList& bookPaths)
+{
+	if (zSyncWatcher)//以最新的书库为准
+	{
+		zSyncWatcher->cancel();
+		zSyncWatcher = nullptr;
+	}
+	zChangedWhileSyncing.clear();
+
+	//书库很大时逐本打开段文件、读取书籍信息会卡住界面，全部放到工作线程，这里只传入书库的路径
+	const QString suffix = temporarySuffix();
+	QFuture<fullTextSyncResult> future = QtConcurrent::run([bookPaths, suffix](QPromise<fullTextSyncResult>& promise) {
+		fullTextSyncResult result;
+		QDir dir(QDir::currentPath() + "/fulltext");
+		QSet<QString> segmentFiles;
+		if (dir.exists())
+		{
+			//以前退出时没写完的文件
+			const QStringList partialFiles = dir.entryList(QStringList() << "*.tmp", QDir::Files);
+			for (const QString& fileName : partialFiles)
+			{
+				if (!fileName.contains(suffix))
+				{
+					dir.remove(fileName);
+				}
+			}
+			const QStringList files = dir.entryList(QStringList() << "*.seg", QDir::Files);
+			segmentFiles = QSet<QString>(files.cbegin(), files.cend());
+		}
+
+		for (const QString& bookPath : bookPaths)
+		{
+			if (promise.isCanceled())
+			{
+				return;
+			}
+			const QString filePath = segmentPath(bookPath);
+			fullTextSource source;
+			if (segmentFiles.remove(QFileInfo(filePath).fileName()))
+			{
+				if (readSegmentSource(filePath, source) && source.bookPath == bookPath)
+				{
+					result.indexed.append(source);//过期的段在重建完成前仍可查询
+				}
+				else
+				{
+					source = fullTextSource();//格式不符时当作没有索引，重建时覆盖
+				}
+			}
+
+			const QFileInfo info(bookPath);
+			if (info.exists() && !isSourceUnchanged(info, source))
+			{
+				result.stalePaths.append(bookPath);
+			}
+		}
+
+		for (const QString& fileName : std::as_const(segmentFiles))
+		{
+			result.orphanFiles.append(dir.filePath(fileName));
+		}
+		promise.addResult(result);
+		});
+
+	QFutureWatcher<fullTextSyncResult>* watcher = new QFutureWatcher<fullTextSyncResult>(this);
+	connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+		watcher->deleteLater();
+		if (watcher != zSyncWatcher)//已被取消
+		{
+			return;
+		}
+		zSyncWatcher = nullptr;
+
+		const QFuture<fullTextSyncResult> result = watcher->future();
+		if (result.resultCount() > 0)
+		{
+			applySyncResult(result.result());
+		}
+		zChangedWhileSyncing.clear();
+		});
+
+	zSyncWatcher = watcher;
+	watcher->setFuture(future);
+}
+
+void fullTextIndex::applySyncResult(const fullTextSyncResult& result)
+{
+	//扫描期间删除或重建了索引的书，以当前状态为准
+	for (const fullTextSource& source : result.indexed)
+	{
+		if (!zChangedWhileSyncing.contains(source.bookPath))
+		{
+			zIndexed.insert(source.bookPath, source);
+		}
+	}
+
+	QSet<QString> changedFiles;
+	for (const QString& bookPath : std::as_const(zChangedWhileSyncing))
+	{
+		changedFiles.insert(segmentPath(bookPath));
+	}
+	for (const QString& filePath : result.orphanFiles)
+	{
+		if (!changedFiles.contains(filePath))
+		{
+			QFile::remove(filePath);
+		}
+	}
+
+	QStringList stalePaths = result.stalePaths;
+	stalePaths.removeIf([this](const QString& bookPath) {
+		return zChangedWhileSyncing.contains(bookPath);
+		});
+	enqueueBooks(stalePaths);
+}
+
+void fullTextIndex::addBook(const QString& bookPath)
+{
+	if (bookPath == zBuildingPath || zQueue.contains(bookPath) || isUpToDate(bookPath))
+	{
+		return;
+	}
+	if (!QFileInfo::exists(bookPath))
+	{
+		return;
+	}
+
+	enqueueBooks(QStringList() << bookPath);
+}
+
+void fullTextIndex::enqueueBooks(const QStringList& bookPaths)
+{
+	const qsizetype queuedBefore = zQueue.size();
+	QSet<QString> queued(zQueue.cbegin(), zQueue.cend());
+	for (const QString& bookPath : bookPaths)
+	{
+		if (bookPath != zBuildingPath && !queued.contains(bookPath))
+		{
+			queued.insert(bookPath);
+			zQueue.append(bookPath);
+		}
+	}
+	if (zQueue.size() == queuedBefore)
+	{
+		return;
+	}
+
+	if (!zWatcher)
+	{
+		startNext();
+	}
+	else
+	{
+		emit pendingChanged(int(zQueue.size()) + 1);
+	}
+}
+
+void fullTextIndex::removeBook(const QString& bookPath)
+{
+	if (zSyncWatcher)
+	{
+		zChangedWhileSyncing.insert(bookPath);
+	}
+	zQueue.removeAll(bookPath);
+	if (bookPath == zBuildingPath && zWatcher)
+	{
+		zWatcher->cancel();
+		zWatcher = nullptr;
+		zBuildingPath.clear();
+		startNext();
+	}
+
+	zSegments.remove(bookPath);//先解除映射才能删除文件
+	if (zIndexed.remove(bookPath))
+	{
+		QFile::remove(segmentPath(bookPath));
+	}
+}
+
+bool fullTextIndex::contains(const QString& bookPath) const
+{
+	return zIndexed.contains(bookPath);
+}
+
+bool fullTextIndex::isIndexing() const
+{
+	return zWatcher != nullptr;
+}
+
+bool fullTextIndex::isUpToDate(const QString& bookPath) const
+{
+	const auto it = zIndexed.constFind(bookPath);
+	return it != zIndexed.constEnd() && isSourceUnchanged(QFileInfo(bookPath), it.value());
+}
+
+void fullTextIndex::startNext()
+{
+	if (zQueue.isEmpty())
+	{
+		emit pendingChanged(0);
+		return;
+	}
+
+	zBuildingPath = zQueue.takeFirst();
+	emit pendingChanged(int(zQueue.size()) + 1);
+
+	const QString bookPath = zBuildingPath;
+	//取消的任务可能还在写同一本书，临时文件名不能重复
+	const QString outputPath = segmentPath(bookPath) + temporarySuffix() + QString("%1.tmp").arg(++zBuildSerial);
+	QDir().mkpath(QFileInfo(outputPath).absolutePath());
+
+	QFuture<bool> future = QtConcurrent::run([bookPath, outputPath](QPromise<bool>& promise) {
+		const bool built = buildSegment(promise, bookPath, outputPath);
+		if (!built)
+		{
+			QFile::remove(outputPath);
+		}
+		promise.addResult(built);
+		});
+
+	QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>(this);
+	connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, bookPath, outputPath]() {
+		watcher->deleteLater();
+		if (watcher != zWatcher)//已被取消
+		{
+			return;
+		}
+		zWatcher = nullptr;
+		zBuildingPath.clear();
+
+		const QFuture<bool> result = watcher->future();
+		if (result.resultCount() > 0 && result.result())
+		{
+			installSegment(bookPath, outputPath);
+		}
+		startNext();
+		});
+
+	zWatcher = watcher;
+	watcher->setFuture(future);
+}
+
+void fullTextIndex::installSegment(const QString& bookPath, const QString& builtPath)
+{
+	//映射中的文件不能被替换，先解除旧段的映射
+	const QString finalPath = segmentPath(bookPath);
+	zSegments.remove(bookPath);
+	zIndexed.remove(bookPath);
+	QFile::remove(finalPath);
+	if (!QFile::rename(builtPath, finalPath))
+	{
+		qWarning() << "could not install full text segment" << finalPath;
+		QFile::remove(builtPath);
+		return;
+	}
+
+	fullTextSource source;
+	if (!readSegmentSource(finalPath, source))
+	{
+		return;
+	}
+	zIndexed.insert(bookPath, source);//查询时再映射
+	if (zSyncWatcher)
+	{
+		zChangedWhileSyncing.insert(bookPath);
+	}
+	emit bookIndexed(bookPath);
+}
+
+bool fullTextIndex::buildSegment(QPromise<bool>& promise, const QString& bookPath, const QString& outputPath)
+{
+	const QFileInfo sourceInfo(bookPath);
+
+	readerform parser(nullptr);//只在本线程中使用
+	if (!parser.openEpub(bookPath, MAPPED_ARCHIVE))
+	{
+		qWarning() << "could not index" << bookPath << parser.getLastError();
+		return false;
+	}
+
+	QStringList spineIds;
+	const QList<SpineItem> spine = parser.getSpineItem();
+	for (const SpineItem& item : spine)
+	{
+		if (item.linear)//与阅读界面的章节下标一致
+		{
+			spineIds.append(item.idref);
+		}
+	}
+
+	//键->(章节<<32 | 词序)，逐章追加，天然有序
+	QHash<quint64, QList<quint64>> postings;
+	QList<fullTextSegment::chapterEntry> chapters;
+	chapters.reserve(spineIds.size());
+
+	epubEntryReader reader(parser.readSnapshot());
+	for (int i = 0; i < spineIds.size(); ++i)
+	{
+		if (promise.isCanceled())
+		{
+			return false;
+		}
+
+		//只要纯文本，不需要排版和图片
+		QTextDocument document;
+		document.setHtml(QString::fromUtf8(reader.readContentById(spineIds.at(i))));
+		const QString plainText = document.toPlainText();
+
+		fullTextSegment::chapterEntry chapter;
+		chapter.id = spineIds.at(i);
+		chapter.label = chapterLabel(plainText);
+		chapter.tokenCount = tokenize(plainText, INDEX_TOKENS, [&postings, i](quint64 key, quint32 position) {
+			postings[key].append(quint64(i) << 32 | position);
+			});
+		chapters.append(chapter);
+	}
+
+	QList<quint64> keys = postings.keys();
+	std::sort(keys.begin(), keys.end());
+
+	QByteArray strings;
+	const QByteArray pathUtf8 = bookPath.toUtf8();
+	appendU32(strings, quint32(pathUtf8.size()));
+	strings.append(pathUtf8);
+	for (const fullTextSegment::chapterEntry& chapter : chapters)
+	{
+		appendShortString(strings, chapter.id);
+		appendShortString(strings, chapter.label);
+		appendU32(strings, chapter.tokenCount);
+	}
+	while ((kHeaderSize + strings.size()) % 8 != 0)
+	{
+		strings.append('\0');
+	}
+
+	QByteArray data;
+	appendU32(data, kSegmentMagic);
+	appendU16(data, kSegmentVersion);
+	appendU16(data, 0);
+	appendU64(data, quint64(sourceInfo.size()));
+	appendU64(data, quint64(sourceInfo.lastModified().toMSecsSinceEpoch()));
+	appendU32(data, quint32(chapters.size()));
+	appendU32(data, quint32(keys.size()));
+	appendU64(data, quint64(kHeaderSize + strings.size()));
+	data.append(strings);
+
+	quint32 first = 0;
+	for (quint64 key : keys)
+	{
+		const quint32 count = quint32(postings.value(key).size());
+		appendU64(data, key);
+		appendU32(data, first);
+		appendU32(data, count);
+		first += count;
+	}
+	for (quint64 key : keys)
+	{
+		const QList<quint64>& positions = postings[key];
+		for (quint64 posting : positions)
+		{
+			appendU32(data, quint32(posting >> 32));
+			appendU32(data, quint32(posting));
+		}
+	}
+
+	if (promise.isCanceled())
+	{
+		return false;
+	}
+
+	QFile file(outputPath);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+	{
+		qWarning() << "could not write full text segment" << outputPath << file.errorString();
+		return false;
+	}
+	return true;
+}
+
+QList<fullTextHit> fullTextIndex::search(const QString& text, int maxHits) const
+{
+	struct queryTerm
+	{
+		quint64 key;
+		quint32 offset;//在查询中的词序
+	};
+	QList<queryTerm> terms;
+	tokenize(text, QUERY_TOKENS, [&terms](quint64 key, quint32 position) {
+		terms.append({ key, position });
+		});
+	if (terms.isEmpty() || zIndexed.isEmpty() || maxHits <= 0)
+	{
+		return QList<fullTextHit>();
+	}
+
+	//只有包含全部词条的书才需要逐章比较
+	struct candidate
+	{
+		const fullTextSegment* segment;
+		QList<postingSpan> spans;
+	};
+	QList<candidate> candidates;
+	QList<quint64> chapterFrequency(terms.size(), 0);
+	quint64 chapterTotal = 0;
+	quint64 tokenTotal = 0;
+	QList<std::shared_ptr<fullTextSegment>> segments;//查询期间持有，候选中只存指针
+	segments.reserve(zIndexed.size());
+	for (auto it = zIndexed.constBegin(); it != zIndexed.constEnd(); ++it)
+	{
+		if (std::shared_ptr<fullTextSegment> opened = this->segment(it.key()))
+		{
+			segments.append(opened);
+		}
+	}
+	for (const std::shared_ptr<fullTextSegment>& segment : std::as_const(segments))
+	{
+		chapterTotal += quint64(segment->chapters.size());
+		tokenTotal += segment->totalTokens;
+
+		candidate current{ segment.get(), {} };
+		current.spans.reserve(terms.size());
+		for (const queryTerm& term : terms)
+		{
+			const postingSpan span = segment->find(term.key);
+			if (span.count == 0)
+			{
+				break;
+			}
+			current.spans.append(span);
+		}
+		if (current.spans.size() != terms.size())
+		{
+			continue;
+		}
+		for (qsizetype t = 0; t < terms.size(); ++t)
+		{
+			chapterFrequency[t] += current.spans.at(t).chapterCount();
+		}
+		candidates.append(current);
+	}
+	if (candidates.isEmpty())
+	{
+		return QList<fullTextHit>();
+	}
+
+	QList<double> idf(terms.size());
+	for (qsizetype t = 0; t < terms.size(); ++t)
+	{
+		const double frequency = double(chapterFrequency.at(t));
+		idf[t] = std::log(1.0 + (double(chapterTotal) - frequency + 0.5) / (frequency + 0.5));
+	}
+	const double averageLength = chapterTotal > 0 ? qMax(1.0, double(tokenTotal) / double(chapterTotal)) : 1.0;
+
+	QList<fullTextHit> hits;
+	QList<quint32> begins(terms.size());
+	QList<quint32> ends(terms.size());
+	for (const candidate& current : candidates)
+	{
+		//从位置最少的词条出发
+		qsizetype rarest = 0;
+		for (qsizetype t = 1; t < terms.size(); ++t)
+		{
+			if (current.spans.at(t).count < current.spans.at(rarest).count)
+			{
+				rarest = t;
+			}
+		}
+
+		const postingSpan& driver = current.spans.at(rarest);
+		quint32 i = 0;
+		while (i < driver.count)
+		{
+			const quint32 chapter = driver.chapterAt(i);
+			const quint32 chapterEnd = driver.lowerBound(chapter + 1);
+
+			bool allPresent = true;
+			for (qsizetype t = 0; t < terms.size() && allPresent; ++t)
+			{
+				const postingSpan& span = current.spans.at(t);
+				begins[t] = t == rarest ? i : span.lowerBound(chapter);
+				ends[t] = t == rarest ? chapterEnd : span.lowerBound(chapter + 1);
+				allPresent = begins.at(t) < ends.at(t);
+			}
+
+			if (allPresent && chapter < quint32(current.segment->chapters.size()))
+			{
+				const fullTextSegment::chapterEntry& entry = current.segment->chapters.at(chapter);
+				const double lengthNorm = 1.0 - kLengthWeight + kLengthWeight * double(entry.tokenCount) / averageLength;
+
+				double score = 0;
+				for (qsizetype t = 0; t < terms.size(); ++t)
+				{
+					const double frequency = double(ends.at(t) - begins.at(t));
+					score += idf.at(t) * frequency * (kTermSaturation + 1.0) / (frequency + kTermSaturation * lengthNorm);
+				}
+
+				//词条按查询中的顺序相邻出现的次数
+				quint32 phrases = 0;
+				for (quint32 p = begins.at(rarest); p < ends.at(rarest); ++p)
+				{
+					const quint32 position = driver.positionAt(p);
+					if (position < terms.at(rarest).offset)
+					{
+						continue;
+					}
+					const quint32 start = position - terms.at(rarest).offset;
+					bool matched = true;
+					for (qsizetype t = 0; t < terms.size() && matched; ++t)
+					{
+						matched = t == rarest || current.spans.at(t).containsPosition(begins.at(t), ends.at(t), start + terms.at(t).offset);
+					}
+					if (matched)
+					{
+						++phrases;
+					}
+				}
+				if (phrases > 0)
+				{
+					score *= 2.0 + std::log(double(phrases));
+				}
+
+				fullTextHit hit;
+				hit.bookPath = current.segment->bookPath;
+				hit.chapterId = entry.id;
+				hit.chapterIndex = int(chapter);
+				hit.chapterLabel = entry.label;
+				hit.score = score;
+				hits.append(hit);
+			}
+			i = chapterEnd;
+		}
+	}
+
+	std::sort(hits.begin(), hits.end(), [](const fullTextHit& a, const fullTextHit& b) {
+		return a.score > b.score;
+		});
+	if (hits.size() > maxHits)
+	{
+		hits.resize(maxHits);
+	}
+	return hits;
+}
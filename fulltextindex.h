@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QFutureWatcher>
+#include <QPromise>
+#include <memory>
+
+//全文检索的一条结果
+struct fullTextHit
+{
+	QString bookPath;//书籍路径
+	QString chapterId;//章节id
+	int chapterIndex = -1;//在spine线性部分中的下标
+	QString chapterLabel;//章节开头的一行文字
+	double score = 0;//相关度，越大越靠前
+};
+
+//段文件记录的书籍文件信息，用来判断索引是否过期
+struct fullTextSource
+{
+	QString bookPath;
+	qint64 size = -1;//建立索引时书籍文件的大小
+	qint64 modified = 0;//建立索引时书籍文件的修改时间
+};
+
+class fullTextSegment;
+struct fullTextSyncResult;
+
+//书库的全文倒排索引，每本书一个段文件，保存在程序目录的fulltext下
+//添加书籍时在后台逐本建立；已有的段文件在syncLibrary时由后台扫描，首次查询时才映射
+//查询时直接在映射的段文件上二分查找，不读入内存
+//中日韩文字按单字和相邻两字切分，其余文字按连续的字母数字切分，词条都带位置，用于短语匹配
+class fullTextIndex  : public QObject
+{
+	Q_OBJECT
+
+public:
+	fullTextIndex(QObject *parent);
+	~fullTextIndex();
+	//与书库同步：在后台扫描段文件，删除不在列表中的索引，为没有索引或索引过期的书排队
+	void syncLibrary(const QStringList& bookPaths);
+	//为一本书排队建立索引，已是最新时不做任何事
+	void addBook(const QString& bookPath);
+	//删除一本书的索引
+	void removeBook(const QString& bookPath);
+	//书籍是否已有索引
+	bool contains(const QString& bookPath) const;
+	//是否正在建立索引
+	bool isIndexing() const;
+	//查询，按相关度返回最多maxHits个章节
+	QList<fullTextHit> search(const QString& text, int maxHits = 50) const;
+
+signals:
+	//一本书的索引建立完成
+	void bookIndexed(const QString& bookPath);
+	//等待建立索引的书籍数(含正在建立的)
+	void pendingChanged(int pendingBooks);
+
+private:
+	//段文件路径
+	static QString segmentPath(const QString& bookPath);
+	//建立一本书的段文件，在工作线程中调用
+	static bool buildSegment(QPromise<bool>& promise, const QString& bookPath, const QString& outputPath);
+
+	//取得一本书的段，第一次使用时才映射
+	std::shared_ptr<fullTextSegment> segment(const QString& bookPath) const;
+	//后台扫描的结果
+	void applySyncResult(const fullTextSyncResult& result);
+	//段文件是否与书籍文件一致
+	bool isUpToDate(const QString& bookPath) const;
+	//把书籍加入队列，正在建立或已在队列中的跳过
+	void enqueueBooks(const QStringList& bookPaths);
+	//开始下一本书
+	void startNext();
+	//替换为新建立的段文件
+	void installSegment(const QString& bookPath, const QString& builtPath);
+
+	QHash<QString, fullTextSource> zIndexed;//有段文件的书籍路径->段中记录的书籍文件信息
+	mutable QHash<QString, std::shared_ptr<fullTextSegment>> zSegments;//已映射的段，书籍路径->段
+	QStringList zQueue;//等待建立索引的书籍
+	QString zBuildingPath;//正在建立索引的书籍
+	QFutureWatcher<bool>* zWatcher;//当前的建立任务
+	QFutureWatcher<fullTextSyncResult>* zSyncWatcher;//后台扫描段文件并检查哪些书需要建立索引
+	QSet<QString> zChangedWhileSyncing;//检查期间删除或重建了索引的书，检查结果对它们已过时
+	quint64 zBuildSerial;//临时文件编号
+};
@@ -0,0 +1,373 @@
+#include "librarymodel.h"
+#include <algorithm>
+
+libraryModel::libraryModel(const QMap<QString, BookInfo>* books, QObject* parent)
+	: QAbstractListModel(parent), zBooks(books), zSortMethod(SORT_BY_NAME), zBookIcon(":/icons/book.svg")
+{}
+
+libraryModel::~libraryModel()
+{}
+
+int libraryModel::rowCount(const QModelIndex& parent) const
+{
+	return parent.isValid() ? 0 : zVisible.size();
+}
+
+QVariant libraryModel::data(const QModelIndex& index, int role) const
+{
+	if (!index.isValid() || index.row() >= zVisible.size())
+	{
+		return QVariant();
+	}
+
+	const QString& filePath = zEntries.at(zVisible.at(index.row())).filePath;
+	auto it = zBooks->constFind(filePath);
+	if (it == zBooks->constEnd())
+	{
+		return QVariant();
+	}
+
+	switch (role)
+	{
+	case Qt::DisplayRole:
+		return displayText(it.value());
+	case Qt::DecorationRole:
+		return zCovers.value(it->bookId, zBookIcon);
+	case FilePathRole:
+		return filePath;
+	case TitleRole:
+		return it->title;
+	case ReadTimeRole:
+		return it->totalReadTime;
+	case LastReadTimeRole:
+		return it->lastReadTime;
+	default:
+		return QVariant();
+	}
+}
+
+void libraryModel::reload()
+{
+	beginResetModel();
+	zEntries.clear();
+	zIds.clear();
+	zSearchIndex.clear();
+	zEntries.reserve(zBooks->size());
+	zIds.reserve(zBooks->size());
+	for (auto it = zBooks->constBegin(); it != zBooks->constEnd(); ++it)
+	{
+		const int id = zEntries.size();
+		zIds.insert(it.key(), id);
+		zEntries.append(makeEntry(it.value()));
+		zSearchIndex.setDocument(id, searchText(it.value()));
+	}
+
+	//只有整体载入时才完整排序一次
+	for (int method = 0; method < SORT_METHOD_COUNT; ++method)
+	{
+		QList<int>& order = zOrders[method];
+		order.resize(zEntries.size());
+		for (int i = 0; i < order.size(); ++i)
+		{
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [this, method](int a, int b) {
+			return entryLess(method, zEntries.at(a), zEntries.at(b));
+			});
+	}
+	zVisible = visibleIds();
+	endResetModel();
+}
+
+void libraryModel::addBook(const QString& filePath)
+{
+	auto book = zBooks->constFind(filePath);
+	if (zIds.contains(filePath) || book == zBooks->constEnd())
+	{
+		return;
+	}
+
+	const int id = zEntries.size();
+	zIds.insert(filePath, id);
+	zEntries.append(makeEntry(book.value()));
+	zSearchIndex.setDocument(id, searchText(book.value()));
+	insertIntoOrders(id);
+
+	if (!matchesSearch(id))
+	{
+		return;
+	}
+
+	const int row = lowerBound(zVisible, zSortMethod, zEntries.at(id));
+	beginInsertRows(QModelIndex(), row, row);
+	zVisible.insert(row, id);
+	endInsertRows();
+}
+
+void libraryModel::removeBook(const QString& filePath)
+{
+	auto it = zIds.constFind(filePath);
+	if (it == zIds.constEnd())
+	{
+		return;
+	}
+
+	const int id = it.value();
+	const int row = lowerBound(zVisible, zSortMethod, zEntries.at(id));
+	const bool visible = row < zVisible.size() && zVisible.at(row) == id;
+	if (visible)
+	{
+		beginRemoveRows(QModelIndex(), row, row);
+		zVisible.removeAt(row);
+	}
+
+	//只留下空位，不移动其他书的id
+	removeFromOrders(id);
+	zIds.remove(filePath);
+	zSearchIndex.removeDocument(id);
+
+	if (visible)
+	{
+		endRemoveRows();
+	}
+}
+
+void libraryModel::setCovers(const QHash<QString, QString>& thumbnailPaths)
+{
+	zCovers.clear();
+	zCovers.reserve(thumbnailPaths.size());
+	for (auto it = thumbnailPaths.cbegin(); it != thumbnailPaths.cend(); ++it)
+	{
+		zCovers.insert(it.key(), QIcon(it.value()));
+	}
+	if (!zVisible.isEmpty())
+	{
+		emit dataChanged(index(0), index(zVisible.size() - 1), { Qt::DecorationRole });
+	}
+}
+
+void libraryModel::addCover(const QString& bookId, const QString& thumbnailPath)
+{
+	zCovers.insert(bookId, QIcon(thumbnailPath));
+}
+
+void libraryModel::bookChanged(const QString& filePath)
+{
+	auto idIt = zIds.constFind(filePath);
+	auto book = zBooks->constFind(filePath);
+	if (idIt == zIds.constEnd() || book == zBooks->constEnd())
+	{
+		return;
+	}
+
+	const int id = idIt.value();
+	int oldRow = lowerBound(zVisible, zSortMethod, zEntries.at(id));//用旧的键定位
+	if (oldRow >= zVisible.size() || zVisible.at(oldRow) != id)
+	{
+		oldRow = -1;
+	}
+
+	//排序键不变时只刷新这一行
+	libraryEntry entry = makeEntry(book.value());
+	const libraryEntry& old = zEntries.at(id);
+	if (entry.titleKey.compare(old.titleKey) != 0 || entry.readTime != old.readTime || entry.lastReadTime != old.lastReadTime)
+	{
+		removeFromOrders(id);
+		zEntries[id] = entry;
+		insertIntoOrders(id);
+	}
+	zSearchIndex.setDocument(id, searchText(book.value()));
+
+	const bool visible = matchesSearch(id);
+	if (oldRow < 0 && !visible)
+	{
+		return;
+	}
+	if (oldRow < 0)
+	{
+		const int row = lowerBound(zVisible, zSortMethod, zEntries.at(id));
+		beginInsertRows(QModelIndex(), row, row);
+		zVisible.insert(row, id);
+		endInsertRows();
+		return;
+	}
+	if (!visible)
+	{
+		beginRemoveRows(QModelIndex(), oldRow, oldRow);
+		zVisible.removeAt(oldRow);
+		endRemoveRows();
+		return;
+	}
+
+	//在去掉自己之后的列表中找新位置
+	zVisible.removeAt(oldRow);
+	const int newRow = lowerBound(zVisible, zSortMethod, zEntries.at(id));
+	zVisible.insert(oldRow, id);
+	if (newRow != oldRow)
+	{
+		beginMoveRows(QModelIndex(), oldRow, oldRow, QModelIndex(), newRow > oldRow ? newRow + 1 : newRow);
+		zVisible.removeAt(oldRow);
+		zVisible.insert(newRow, id);
+		endMoveRows();
+	}
+
+	const QModelIndex changed = index(newRow);
+	emit dataChanged(changed, changed);
+}
+
+void libraryModel::setSortMethod(int sortMethod)
+{
+	if (sortMethod < 0 || sortMethod >= SORT_METHOD_COUNT || sortMethod == zSortMethod)
+	{
+		return;
+	}
+
+	//行的集合不变，只换顺序，保留选中项
+	emit layoutAboutToBeChanged();
+	zSortMethod = sortMethod;
+	const QList<int> oldVisible = zVisible;
+	zVisible = visibleIds();
+
+	const QModelIndexList oldIndexes = persistentIndexList();
+	for (const QModelIndex& oldIndex : oldIndexes)
+	{
+		const int row = zVisible.indexOf(oldVisible.value(oldIndex.row(), -1));
+		changePersistentIndex(oldIndex, row < 0 ? QModelIndex() : index(row));
+	}
+	emit layoutChanged();
+}
+
+void libraryModel::setSearchText(const QString& text)
+{
+	if (zSearchText == text)
+	{
+		return;
+	}
+
+	beginResetModel();
+	zSearchText = text;
+	zVisible = visibleIds();
+	endResetModel();
+}
+
+QStringList libraryModel::searchPaths(const QString& text) const
+{
+	QStringList paths;
+	const QList<int> ids = zSearchIndex.search(text);
+	paths.reserve(ids.size());
+	for (int id : ids)
+	{
+		paths.append(zEntries.at(id).filePath);
+	}
+	return paths;
+}
+
+QString libraryModel::displayText(const BookInfo& book)
+{
+	// 计算时间显示格式
+	QString timeStr;
+	int hours = book.totalReadTime.hour();
+	int minutes = book.totalReadTime.minute();
+
+	if (hours > 0) {
+		timeStr = QString("%1时%2分").arg(hours).arg(minutes);
+	} else {
+		timeStr = QString("%1分").arg(minutes);
+	}
+
+	return QString("%1\n阅读时间: %2").arg(book.title, timeStr);
+}
+
+libraryModel::libraryEntry libraryModel::makeEntry(const BookInfo& book) const
+{
+	return libraryEntry{ book.filePath, zCollator.sortKey(book.title), book.totalReadTime, book.lastReadTime };
+}
+
+QString libraryModel::searchText(const BookInfo& book)
+{
+	//用换行分隔，查询中不会出现换行，不会跨字段匹配
+	QString text = book.title;
+	for (const QString& author : book.authors)
+	{
+		text += QChar('\n');
+		text += author;
+	}
+	for (const QString& subject : book.subjects)
+	{
+		text += QChar('\n');
+		text += subject;
+	}
+	return text;
+}
+
+bool libraryModel::entryLess(int sortMethod, const libraryEntry& a, const libraryEntry& b)
+{
+	if (sortMethod == SORT_BY_READ_TIME) {
+		// 按阅读时间排序，时间长的在前
+		if (a.readTime != b.readTime)
+			return a.readTime > b.readTime;
+	} else if (sortMethod == SORT_BY_RECENT) {
+		// 按最近阅读排序，最近的在前
+		if (a.lastReadTime != b.lastReadTime)
+			return a.lastReadTime > b.lastReadTime;
+	} else {
+		// 按名称排序
+		const int result = a.titleKey.compare(b.titleKey);
+		if (result != 0)
+			return result < 0;
+	}
+	return a.filePath < b.filePath;
+}
+
+int libraryModel::lowerBound(const QList<int>& order, int sortMethod, const libraryEntry& entry) const
+{
+	auto it = std::lower_bound(order.constBegin(), order.constEnd(), entry, [this, sortMethod](int id, const libraryEntry& value) {
+		return entryLess(sortMethod, zEntries.at(id), value);
+		});
+	return int(it - order.constBegin());
+}
+
+void libraryModel::insertIntoOrders(int id)
+{
+	for (int method = 0; method < SORT_METHOD_COUNT; ++method)
+	{
+		zOrders[method].insert(lowerBound(zOrders[method], method, zEntries.at(id)), id);
+	}
+}
+
+void libraryModel::removeFromOrders(int id)
+{
+	for (int method = 0; method < SORT_METHOD_COUNT; ++method)
+	{
+		const int pos = lowerBound(zOrders[method], method, zEntries.at(id));
+		if (pos < zOrders[method].size() && zOrders[method].at(pos) == id)
+		{
+			zOrders[method].removeAt(pos);
+		}
+	}
+}
+
+bool libraryModel::matchesSearch(int id) const
+{
+	if (zSearchText.isEmpty())
+	{
+		return true;
+	}
+	return zSearchIndex.matches(id, zSearchText);
+}
+
+QList<int> libraryModel::visibleIds() const
+{
+	const QList<int>& order = zOrders[zSortMethod];
+	if (zSearchText.isEmpty())
+	{
+		return order;//与排序表共享数据，不复制
+	}
+
+	//只对命中的书按当前方式排序，与书库大小无关
+	QList<int> ids = zSearchIndex.search(zSearchText);
+	std::sort(ids.begin(), ids.end(), [this](int a, int b) {
+		return entryLess(zSortMethod, zEntries.at(a), zEntries.at(b));
+		});
+	return ids;
+}
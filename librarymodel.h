@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QMap>
+#include <QHash>
+#include <QList>
+#include <QIcon>
+#include <QString>
+#include <QStringList>
+#include <QCollator>
+#include <QTime>
+#include <QDateTime>
+#include "bookinfo.h"
+#include "librarysearchindex.h"
+
+//书库列表模型，直接读取主窗口的书籍表，不复制书籍信息
+//按名称、阅读时间、最近阅读三种顺序常驻维护，增删改时只做二分插入，切换排序和搜索不再整体排序
+class libraryModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+public:
+	enum libraryRole
+	{
+		FilePathRole = Qt::UserRole,//与原来列表项的UserRole一致
+		TitleRole,
+		ReadTimeRole,
+		LastReadTimeRole
+	};
+
+	//排序方式，与主窗口的m_sortMethod一致
+	enum librarySortMethod
+	{
+		SORT_BY_NAME,
+		SORT_BY_READ_TIME,
+		SORT_BY_RECENT,
+		SORT_METHOD_COUNT
+	};
+
+	libraryModel(const QMap<QString, BookInfo>* books, QObject* parent);
+	~libraryModel();
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+	//书籍表整体变化后重新载入
+	void reload();
+	//书籍表中新增了一本书
+	void addBook(const QString& filePath);
+	//书籍表中删除了一本书
+	void removeBook(const QString& filePath);
+	//某本书的信息变化，只调整这一行
+	void bookChanged(const QString& filePath);
+	//设置已有封面缩略图的书：书籍标识->缩略图路径，替换原有的封面
+	void setCovers(const QHash<QString, QString>& thumbnailPaths);
+	//一本新书的封面缩略图，在addBook之前调用
+	void addCover(const QString& bookId, const QString& thumbnailPath);
+	//切换排序方式
+	void setSortMethod(int sortMethod);
+	//按标题、作者和主题过滤，为空时显示全部
+	void setSearchText(const QString& text);
+	//标题、作者或主题包含text的书籍路径
+	QStringList searchPaths(const QString& text) const;
+	//列表中显示的文本
+	static QString displayText(const BookInfo& book);
+
+private:
+	//排序用的键，书籍信息变化前的旧值用来在排序表中定位
+	struct libraryEntry
+	{
+		QString filePath;
+		QCollatorSortKey titleKey;
+		QTime readTime;
+		QDateTime lastReadTime;
+	};
+
+	libraryEntry makeEntry(const BookInfo& book) const;
+	//参与搜索的文本
+	static QString searchText(const BookInfo& book);
+	//按某种排序方式a是否排在b前面，键相同时按路径，保证顺序唯一
+	static bool entryLess(int sortMethod, const libraryEntry& a, const libraryEntry& b);
+	//在按当前排序方式排好的id列表中二分查找位置
+	int lowerBound(const QList<int>& order, int sortMethod, const libraryEntry& entry) const;
+	void insertIntoOrders(int id);
+	void removeFromOrders(int id);
+	bool matchesSearch(int id) const;
+	//当前排序和过滤条件下应显示的id
+	QList<int> visibleIds() const;
+
+	const QMap<QString, BookInfo>* zBooks;
+	QCollator zCollator;
+	QList<libraryEntry> zEntries;//id->排序键，删除的书留下空位，id在reload之前保持不变
+	QHash<QString, int> zIds;//书籍路径->id
+	librarySearchIndex zSearchIndex;//id->搜索文本的索引
+	QList<int> zOrders[SORT_METHOD_COUNT];//每种排序方式下的id顺序
+	QList<int> zVisible;//行->id
+	int zSortMethod;
+	QString zSearchText;
+	QIcon zBookIcon;//没有封面的书共用一个图标
+	QHash<QString, QIcon> zCovers;//书籍标识->封面缩略图，QIcon在绘制时才读文件
+};
@@ -0,0 +1,199 @@
+#include "librarysearchindex.h"
+#include <algorithm>
+#include <iterator>
+
+void librarySearchIndex::clear()
+{
+	zPostings.clear();
+	zDocuments.clear();
+}
+
+void librarySearchIndex::setDocument(int id, const QString& text)
+{
+	const QString folded = text.toCaseFolded();
+	auto it = zDocuments.constFind(id);
+	if (it != zDocuments.constEnd())
+	{
+		if (it.value() == folded)//文本没变，索引不用动
+		{
+			return;
+		}
+		removeDocument(id);
+	}
+
+	const QList<quint64> grams = documentGrams(folded);
+	for (quint64 key : grams)
+	{
+		addPosting(key, id);
+	}
+	zDocuments.insert(id, folded);
+}
+
+void librarySearchIndex::removeDocument(int id)
+{
+	auto it = zDocuments.find(id);
+	if (it == zDocuments.end())
+	{
+		return;
+	}
+
+	const QList<quint64> grams = documentGrams(it.value());
+	for (quint64 key : grams)
+	{
+		removePosting(key, id);
+	}
+	zDocuments.erase(it);
+}
+
+QList<int> librarySearchIndex::search(const QString& query) const
+{
+	const QString folded = query.toCaseFolded();
+	QList<int> candidates;
+	const QList<quint64> grams = queryGrams(folded);
+	if (grams.isEmpty())//空查询匹配全部文档
+	{
+		candidates = zDocuments.keys();
+		std::sort(candidates.begin(), candidates.end());
+		return candidates;
+	}
+
+	//从最短的倒排表开始求交集
+	QList<const QList<int>*> postings;
+	postings.reserve(grams.size());
+	for (quint64 key : grams)
+	{
+		auto it = zPostings.constFind(key);
+		if (it == zPostings.constEnd())
+		{
+			return QList<int>();
+		}
+		postings.append(&it.value());
+	}
+	std::sort(postings.begin(), postings.end(), [](const QList<int>* a, const QList<int>* b) {
+		return a->size() < b->size();
+		});
+
+	candidates = *postings.first();
+	for (int i = 1; i < postings.size() && !candidates.isEmpty(); ++i)
+	{
+		QList<int> intersection;
+		std::set_intersection(candidates.constBegin(), candidates.constEnd(),
+			postings.at(i)->constBegin(), postings.at(i)->constEnd(), std::back_inserter(intersection));
+		candidates = intersection;
+	}
+
+	//不超过三个字符时键就是查询本身，候选即结果
+	if (folded.size() <= 3)
+	{
+		return candidates;
+	}
+
+	//n-gram都出现不代表子串出现，最后逐个确认
+	QList<int> result;
+	for (int id : std::as_const(candidates))
+	{
+		if (zDocuments.value(id).contains(folded))
+		{
+			result.append(id);
+		}
+	}
+	return result;
+}
+
+bool librarySearchIndex::matches(int id, const QString& query) const
+{
+	auto it = zDocuments.constFind(id);
+	return it != zDocuments.constEnd() && it.value().contains(query.toCaseFolded());
+}
+
+quint64 librarySearchIndex::gramKey(const QChar* p, int n)
+{
+	quint64 key = quint64(n) << 48;//高位记录长度，避免不同长度的键冲突
+	for (int i = 0; i < n; ++i)
+	{
+		key |= quint64(p[i].unicode()) << (16 * (2 - i));
+	}
+	return key;
+}
+
+QList<quint64> librarySearchIndex::documentGrams(const QString& folded)
+{
+	QList<quint64> grams;
+	const QChar* data = folded.constData();
+	const int size = int(folded.size());
+	grams.reserve(size * 2);
+	for (int i = 0; i < size; ++i)
+	{
+		grams.append(gramKey(data + i, 1));
+		if (i + 2 <= size)
+		{
+			grams.append(gramKey(data + i, 2));
+		}
+		if (i + 3 <= size)
+		{
+			grams.append(gramKey(data + i, 3));
+		}
+	}
+	std::sort(grams.begin(), grams.end());
+	grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+	return grams;
+}
+
+QList<quint64> librarySearchIndex::queryGrams(const QString& folded)
+{
+	QList<quint64> grams;
+	const QChar* data = folded.constData();
+	const int size = int(folded.size());
+	if (size >= 3)
+	{
+		for (int i = 0; i + 3 <= size; ++i)
+		{
+			grams.append(gramKey(data + i, 3));
+		}
+		std::sort(grams.begin(), grams.end());
+		grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+	}
+	else if (size == 2)
+	{
+		grams.append(gramKey(data, 2));
+	}
+	else if (size == 1)
+	{
+		grams.append(gramKey(data, 1));
+	}
+	return grams;
+}
+
+void librarySearchIndex::addPosting(quint64 key, int id)
+{
+	QList<int>& ids = zPostings[key];
+	if (ids.isEmpty() || ids.last() < id)//新书的id最大，通常直接追加
+	{
+		ids.append(id);
+		return;
+	}
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it == ids.end() || *it != id)
+	{
+		ids.insert(it, id);
+	}
+}
+
+void librarySearchIndex::removePosting(quint64 key, int id)
+{
+	auto postingIt = zPostings.find(key);
+	if (postingIt == zPostings.end())
+	{
+		return;
+	}
+	QList<int>& ids = postingIt.value();
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it != ids.end() && *it == id)
+	{
+		ids.erase(it);
+	}
+	if (ids.isEmpty())
+	{
+		zPostings.erase(postingIt);
+	}
+}
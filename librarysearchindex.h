@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+//书库搜索用的n-gram倒排索引
+//每个文档记录全部三元组、二元组和单字，任何非空查询都先求交集得到候选，再逐个确认子串
+class librarySearchIndex
+{
+public:
+	void clear();
+	//添加或替换文档
+	void setDocument(int id, const QString& text);
+	void removeDocument(int id);
+	//包含query(忽略大小写)的文档id，升序
+	QList<int> search(const QString& query) const;
+	//某个文档是否包含query
+	bool matches(int id, const QString& query) const;
+
+private:
+	static quint64 gramKey(const QChar* p, int n);
+	//文档中出现的所有键，已去重
+	static QList<quint64> documentGrams(const QString& folded);
+	//查询需要的键，只有空查询时为空
+	static QList<quint64> queryGrams(const QString& folded);
+
+	void addPosting(quint64 key, int id);
+	void removePosting(quint64 key, int id);
+
+	QHash<quint64, QList<int>> zPostings;//键->升序的文档id
+	QHash<int, QString> zDocuments;//文档id->大小写折叠后的文本
+};
@@ -0,0 +1,569 @@
+#include "librarystore.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+namespace
+{
+	const quint32 kStoreMagic = 0x424C524D;//"MRLB"
+	const quint16 kStoreVersion = 1;
+	const qsizetype kHeaderSize = 10;//魔数(4)+版本(2)+日志代号(4)
+	const quint32 kJournalMagic = 0x4A4C524D;//"MRLJ"
+	const quint16 kJournalVersion = 1;
+	const qsizetype kJournalHeaderSize = 6;
+	const qsizetype kRecordHeaderSize = 5;//类型(1)+长度(4)
+	const qint64 kCompactThreshold = 256 * 1024;//日志超过256KB后在后台压缩
+
+	enum recordKind : quint8
+	{
+		BOOK_RECORD = 1,
+		CATEGORY_RECORD = 2,
+		REMOVE_BOOK_RECORD = 3,//只在日志中出现，内容为书籍标识
+		REMOVE_CATEGORY_RECORD = 4 //只在日志中出现，内容为分类名
+	};
+
+	void appendRecord(QByteArray& out, quint8 kind, const QByteArray& record)
+	{
+		char header[kRecordHeaderSize];
+		header[0] = char(kind);
+		qToLittleEndian(quint32(record.size()), header + 1);
+		out.append(header, kRecordHeaderSize);
+		out.append(record);
+	}
+
+	//依次取出记录，遇到不完整的记录时返回false
+	template <typename Visitor>
+	bool forEachRecord(const QByteArray& data, qsizetype offset, Visitor visit)
+	{
+		while (offset < data.size())
+		{
+			if (offset + kRecordHeaderSize > data.size())
+			{
+				return false;
+			}
+			const quint8 kind = quint8(data.at(offset));
+			const quint32 size = qFromLittleEndian<quint32>(data.constData() + offset + 1);
+			offset += kRecordHeaderSize;
+			if (size > quint64(data.size() - offset))
+			{
+				return false;
+			}
+			visit(kind, data.mid(offset, size));
+			offset += size;
+		}
+		return true;
+	}
+
+	void writeMark(QDataStream& out, const bookMark& mark)
+	{
+		out << mark.chapterId << mark.chapterTitle << qint32(mark.pageInChapter);
+	}
+
+	void readMark(QDataStream& in, bookMark& mark)
+	{
+		qint32 page = 0;
+		in >> mark.chapterId >> mark.chapterTitle >> page;
+		mark.pageInChapter = page;
+	}
+}
+
+libraryStore::libraryStore(const QString& filePath)
+	: zFilePath(filePath), zGeneration(0), zJournalBytes(0)
+{}
+
+libraryStore::~libraryStore()
+{
+	zCompaction.waitForFinished();//压缩只写已编码好的记录，很快结束
+	zJournal.close();
+}
+
+QString libraryStore::defaultPath()
+{
+	return QDir::currentPath() + "/library.db";
+}
+
+bool libraryStore::exists() const
+{
+	return QFileInfo::exists(zFilePath) || !journalGenerations(zFilePath).isEmpty();
+}
+
+QString libraryStore::getLastError() const
+{
+	return zLastError;
+}
+
+QString libraryStore::journalPath(const QString& filePath, quint32 generation)
+{
+	return filePath + QString(".%1.journal").arg(generation);
+}
+
+QList<quint32> libraryStore::journalGenerations(const QString& filePath)
+{
+	const QFileInfo info(filePath);
+	const QString prefix = info.fileName() + ".";
+	const QStringList journalFiles = info.dir().entryList(QStringList() << prefix + "*.journal", QDir::Files);
+
+	QList<quint32> generations;
+	for (const QString& fileName : journalFiles)
+	{
+		bool ok = false;
+		const quint32 generation = QStringView(fileName).mid(prefix.size(), fileName.size() - prefix.size() - 8).toUInt(&ok);
+		if (ok)
+		{
+			generations.append(generation);
+		}
+	}
+	std::sort(generations.begin(), generations.end());
+	return generations;
+}
+
+QByteArray libraryStore::encodeBook(const BookInfo& book) const
+{
+	QByteArray record;
+	QDataStream out(&record, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_6_0);
+	out << book.bookId << book.filePath << book.title << book.authors << book.subjects
+		<< book.totalReadTime << book.isFavorite << book.lastReadTime;
+
+	if (!book.detailLoaded)
+	{
+		//书签和阅读记录还没有读出，沿用已保存的部分
+		const QByteArray detail = storedDetail(book.bookId);
+		if (!detail.isNull())
+		{
+			out.writeRawData(detail.constData(), int(detail.size()));
+			return record;
+		}
+	}
+
+	out << quint32(book.BookMarks.size());
+	for (const bookMark& mark : book.BookMarks)
+	{
+		writeMark(out, mark);
+	}
+	writeMark(out, book.lastReadRecord);
+	return record;
+}
+
+bool libraryStore::decodeBook(const QByteArray& record, BookInfo& book, bool withDetail, qint64* detailOffset)
+{
+	QDataStream in(record);
+	in.setVersion(QDataStream::Qt_6_0);
+	in >> book.bookId >> book.filePath >> book.title >> book.authors >> book.subjects
+		>> book.totalReadTime >> book.isFavorite >> book.lastReadTime;
+	if (detailOffset)
+	{
+		*detailOffset = in.device()->pos();
+	}
+
+	book.BookMarks.clear();
+	book.lastReadRecord = bookMark();
+	book.detailLoaded = withDetail;
+	if (withDetail)
+	{
+		quint32 markCount = 0;
+		in >> markCount;
+		for (quint32 i = 0; i < markCount && in.status() == QDataStream::Ok; ++i)
+		{
+			bookMark mark;
+			readMark(in, mark);
+			book.BookMarks.append(mark);
+		}
+		readMark(in, book.lastReadRecord);
+	}
+	return in.status() == QDataStream::Ok && !book.filePath.isEmpty() && !book.bookId.isEmpty();
+}
+
+QByteArray libraryStore::storedDetail(const QString& bookId) const
+{
+	auto it = zBookRecords.constFind(bookId);
+	if (it == zBookRecords.constEnd())
+	{
+		return QByteArray();
+	}
+	BookInfo summary;
+	qint64 detailOffset = 0;
+	if (!decodeBook(it.value(), summary, false, &detailOffset))
+	{
+		return QByteArray();
+	}
+	return it.value().mid(detailOffset);
+}
+
+bool libraryStore::loadBookDetail(BookInfo& book) const
+{
+	auto it = zBookRecords.constFind(book.bookId);
+	if (it == zBookRecords.constEnd())
+	{
+		book.detailLoaded = true;//还没保存过，没有可读的内容
+		return false;
+	}
+
+	BookInfo stored;
+	if (!decodeBook(it.value(), stored, true))
+	{
+		return false;
+	}
+	book.BookMarks = stored.BookMarks;
+	book.lastReadRecord = stored.lastReadRecord;
+	book.detailLoaded = true;
+	return true;
+}
+
+QByteArray libraryStore::encodeCategory(const QString& name, const QStringList& bookIds)
+{
+	QByteArray record;
+	QDataStream out(&record, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_6_0);
+	out << name << bookIds;
+	return record;
+}
+
+bool libraryStore::decodeCategory(const QByteArray& record, QString& name, QStringList& bookIds)
+{
+	QDataStream in(record);
+	in.setVersion(QDataStream::Qt_6_0);
+	in >> name >> bookIds;
+	return in.status() == QDataStream::Ok && !name.isEmpty();
+}
+
+void libraryStore::applyRecord(quint8 kind, const QByteArray& record)
+{
+	switch (kind)
+	{
+	case BOOK_RECORD:
+	{
+		BookInfo book;
+		if (decodeBook(record, book, false))//只需要标识
+		{
+			zBookRecords.insert(book.bookId, record);
+		}
+		break;
+	}
+	case CATEGORY_RECORD:
+	{
+		QString name;
+		QStringList bookIds;
+		if (decodeCategory(record, name, bookIds))
+		{
+			zCategoryRecords.insert(name, record);
+		}
+		break;
+	}
+	case REMOVE_BOOK_RECORD:
+		zBookRecords.remove(QString::fromUtf8(record));
+		break;
+	case REMOVE_CATEGORY_RECORD:
+		zCategoryRecords.remove(QString::fromUtf8(record));
+		break;
+	default://未知类型的记录直接跳过，便于以后扩展
+		break;
+	}
+}
+
+bool libraryStore::load(QMap<QString, BookInfo>& books, QMap<QString, QStringList>& categories)
+{
+	zBookRecords.clear();
+	zCategoryRecords.clear();
+
+	quint32 snapshotGeneration = 0;//快照已包含此代之前的全部日志
+	QFile file(zFilePath);
+	if (file.exists())
+	{
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			zLastError = QString("could not open %1: %2").arg(zFilePath, file.errorString());
+			return false;
+		}
+
+		const QByteArray data = file.readAll();//一次顺序读出整个文件
+		file.close();
+
+		if (data.size() < kHeaderSize || qFromLittleEndian<quint32>(data.constData()) != kStoreMagic
+			|| qFromLittleEndian<quint16>(data.constData() + 4) != kStoreVersion)
+		{
+			zLastError = QString("%1 is not a library store of version %2").arg(zFilePath).arg(kStoreVersion);
+			return false;
+		}
+		snapshotGeneration = qFromLittleEndian<quint32>(data.constData() + 6);
+
+		const bool complete = forEachRecord(data, kHeaderSize, [this](quint8 kind, const QByteArray& record) {
+			applyRecord(kind, record);
+			});
+		if (!complete)
+		{
+			qWarning() << "library store is truncated:" << zFilePath;
+		}
+	}
+
+	//按顺序重放快照之后的日志
+	quint32 lastGeneration = snapshotGeneration;
+	bool replayed = false;
+	const QList<quint32> generations = journalGenerations(zFilePath);
+	for (quint32 generation : generations)
+	{
+		lastGeneration = qMax(lastGeneration, generation);
+		const QString journalFilePath = journalPath(zFilePath, generation);
+		if (generation < snapshotGeneration || QFileInfo(journalFilePath).size() <= kJournalHeaderSize)//已压缩或没有内容
+		{
+			QFile::remove(journalFilePath);
+			continue;
+		}
+		if (!replayJournal(journalFilePath))
+		{
+			qWarning() << "library journal is truncated, the last change is dropped:" << generation;
+		}
+		replayed = true;
+	}
+
+	for (auto it = zBookRecords.cbegin(); it != zBookRecords.cend(); ++it)
+	{
+		BookInfo book;
+		decodeBook(it.value(), book, false);//书签和阅读记录在打开书籍时再读
+		books.insert(book.filePath, book);
+	}
+	for (auto it = zCategoryRecords.cbegin(); it != zCategoryRecords.cend(); ++it)
+	{
+		QString name;
+		QStringList bookIds;
+		decodeCategory(it.value(), name, bookIds);
+		categories.insert(name, bookIds);
+	}
+
+	//旧日志末尾可能有半条记录，总是从新的一代开始追加
+	if (!openJournal(lastGeneration + 1))
+	{
+		return false;
+	}
+	if (replayed)
+	{
+		compactAsync();
+	}
+	return true;
+}
+
+bool libraryStore::replayJournal(const QString& journalFilePath)
+{
+	QFile file(journalFilePath);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "could not open library journal" << journalFilePath << file.errorString();
+		return false;
+	}
+	const QByteArray data = file.readAll();
+	file.close();
+
+	if (data.size() < kJournalHeaderSize || qFromLittleEndian<quint32>(data.constData()) != kJournalMagic
+		|| qFromLittleEndian<quint16>(data.constData() + 4) != kJournalVersion)
+	{
+		return data.isEmpty();
+	}
+
+	return forEachRecord(data, kJournalHeaderSize, [this](quint8 kind, const QByteArray& record) {
+		applyRecord(kind, record);
+		});
+}
+
+bool libraryStore::openJournal(quint32 generation)
+{
+	zJournal.close();
+	zJournal.setFileName(journalPath(zFilePath, generation));
+	if (!zJournal.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		zLastError = QString("could not open %1: %2").arg(zJournal.fileName(), zJournal.errorString());
+		qWarning() << zLastError;
+		return false;
+	}
+
+	char header[kJournalHeaderSize];
+	qToLittleEndian(kJournalMagic, header);
+	qToLittleEndian(kJournalVersion, header + 4);
+	zJournal.write(header, kJournalHeaderSize);
+	zJournal.flush();
+
+	zGeneration = generation;
+	zJournalBytes = 0;
+	return true;
+}
+
+void libraryStore::appendJournal(quint8 kind, const QByteArray& record)
+{
+	QByteArray entry;
+	appendRecord(entry, kind, record);
+	appendJournalEntries(entry);
+}
+
+void libraryStore::appendJournalEntries(const QByteArray& entries)
+{
+	if (entries.isEmpty())
+	{
+		return;
+	}
+	if (!zJournal.isOpen())//没有load过，或load失败
+	{
+		const QList<quint32> generations = journalGenerations(zFilePath);
+		const quint32 lastGeneration = generations.isEmpty() ? zGeneration : qMax(zGeneration, generations.last());
+		if (!openJournal(lastGeneration + 1))
+		{
+			return;
+		}
+	}
+
+	if (zJournal.write(entries) != entries.size() || !zJournal.flush())//交给系统，进程崩溃也不会丢失
+	{
+		qWarning() << "could not append to library journal" << zJournal.fileName() << zJournal.errorString();
+		return;
+	}
+
+	zJournalBytes += entries.size();
+	if (zJournalBytes >= kCompactThreshold)
+	{
+		compactAsync();
+	}
+}
+
+void libraryStore::putBook(const BookInfo& book)
+{
+	if (book.bookId.isEmpty())
+	{
+		return;
+	}
+	const QByteArray record = encodeBook(book);
+	auto it = zBookRecords.find(book.bookId);
+	if (it != zBookRecords.end() && it.value() == record)
+	{
+		return;
+	}
+	zBookRecords.insert(book.bookId, record);
+	appendJournal(BOOK_RECORD, record);
+}
+
+void libraryStore::putBooks(const QList<BookInfo>& books)
+{
+	QByteArray entries;
+	for (const BookInfo& book : books)
+	{
+		if (book.bookId.isEmpty())
+		{
+			continue;
+		}
+		const QByteArray record = encodeBook(book);
+		auto it = zBookRecords.find(book.bookId);
+		if (it != zBookRecords.end() && it.value() == record)
+		{
+			continue;
+		}
+		zBookRecords.insert(book.bookId, record);
+		appendRecord(entries, BOOK_RECORD, record);
+	}
+	appendJournalEntries(entries);//整批只写一次
+}
+
+void libraryStore::removeBook(const QString& bookId)
+{
+	if (zBookRecords.remove(bookId))
+	{
+		appendJournal(REMOVE_BOOK_RECORD, bookId.toUtf8());
+	}
+}
+
+void libraryStore::putCategory(const QString& name, const QStringList& bookIds)
+{
+	if (name.isEmpty())
+	{
+		return;
+	}
+	const QByteArray record = encodeCategory(name, bookIds);
+	auto it = zCategoryRecords.find(name);
+	if (it != zCategoryRecords.end() && it.value() == record)
+	{
+		return;
+	}
+	zCategoryRecords.insert(name, record);
+	appendJournal(CATEGORY_RECORD, record);
+}
+
+void libraryStore::removeCategory(const QString& name)
+{
+	if (zCategoryRecords.remove(name))
+	{
+		appendJournal(REMOVE_CATEGORY_RECORD, name.toUtf8());
+	}
+}
+
+bool libraryStore::writeSnapshot(const QString& filePath, const QHash<QString, QByteArray>& bookRecords,
+	const QMap<QString, QByteArray>& categoryRecords, quint32 generation, QString* error)
+{
+	//记录已经编码好，这里只是拼接
+	QByteArray data;
+	char header[kHeaderSize];
+	qToLittleEndian(kStoreMagic, header);
+	qToLittleEndian(kStoreVersion, header + 4);
+	qToLittleEndian(generation, header + 6);
+	data.append(header, kHeaderSize);
+	for (auto it = bookRecords.cbegin(); it != bookRecords.cend(); ++it)
+	{
+		appendRecord(data, BOOK_RECORD, it.value());
+	}
+	for (auto it = categoryRecords.cbegin(); it != categoryRecords.cend(); ++it)
+	{
+		appendRecord(data, CATEGORY_RECORD, it.value());
+	}
+
+	QSaveFile file(filePath);//先写临时文件再替换，中途退出不会损坏书库
+	if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+	{
+		*error = QString("could not write %1: %2").arg(filePath, file.errorString());
+		qWarning() << *error;
+		return false;
+	}
+
+	//快照已包含这些日志的内容
+	const QList<quint32> generations = journalGenerations(filePath);
+	for (quint32 oldGeneration : generations)
+	{
+		if (oldGeneration < generation)
+		{
+			QFile::remove(journalPath(filePath, oldGeneration));
+		}
+	}
+	return true;
+}
+
+void libraryStore::compactAsync()
+{
+	if (zCompaction.isRunning())
+	{
+		return;
+	}
+
+	//之后的修改写入新一代日志，快照只需包含到当前为止的状态
+	if (!openJournal(zGeneration + 1))
+	{
+		return;
+	}
+
+	const QString filePath = zFilePath;
+	const QHash<QString, QByteArray> bookRecords = zBookRecords;//隐式共享，不复制数据
+	const QMap<QString, QByteArray> categoryRecords = zCategoryRecords;
+	const quint32 generation = zGeneration;
+	zCompaction = QtConcurrent::run([filePath, bookRecords, categoryRecords, generation]() {
+		QString error;
+		return writeSnapshot(filePath, bookRecords, categoryRecords, generation, &error);
+		});
+}
+
+bool libraryStore::save()
+{
+	zCompaction.waitForFinished();
+	if (!openJournal(zGeneration + 1))
+	{
+		return false;
+	}
+	return writeSnapshot(zFilePath, zBookRecords, zCategoryRecords, zGeneration, &zLastError);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QFile>
+#include <QFuture>
+#include "bookinfo.h"
+
+//书库的持久化存储，替代QSettings中的BookDetail/*和categorys
+//快照是一个带版本号的二进制文件，由若干条记录组成：每本书一条(含书签和阅读记录)，以书籍的稳定标识为键；每个分类一条，只引用标识
+//每次修改立即追加到日志文件，崩溃时不丢失；日志变大后在后台把当前状态写成新快照，再删除旧日志
+//日志按代编号，快照中记录从哪一代开始重放，压缩中途退出也能恢复
+class libraryStore
+{
+public:
+	explicit libraryStore(const QString& filePath);
+	~libraryStore();
+	//默认的存储文件路径
+	static QString defaultPath();
+	//快照或日志是否存在，不存在时需要从旧的注册表迁移
+	bool exists() const;
+	//读出快照并重放日志，得到全部书籍(以路径为键)和分类(值为书籍标识)
+	//只解码书籍的基本信息，书签和阅读记录留在已读入的记录里，由loadBookDetail按需解码
+	bool load(QMap<QString, BookInfo>& books, QMap<QString, QStringList>& categories);
+	//解码一本书的书签和阅读记录
+	bool loadBookDetail(BookInfo& book) const;
+	//写入或更新一本书，以book.bookId为键；书签和阅读记录未读出时保留已保存的内容
+	void putBook(const BookInfo& book);
+	//批量写入，整批一次追加到日志，用于导入
+	void putBooks(const QList<BookInfo>& books);
+	//删除一本书
+	void removeBook(const QString& bookId);
+	//写入或更新一个分类
+	void putCategory(const QString& name, const QStringList& bookIds);
+	//删除一个分类
+	void removeCategory(const QString& name);
+	//立即把当前状态写成快照并清空日志
+	bool save();
+	//获取错误信息
+	QString getLastError() const;
+
+private:
+	Q_DISABLE_COPY(libraryStore)
+
+	QByteArray encodeBook(const BookInfo& book) const;
+	//withDetail为false时只解码基本信息，detailOffset返回书签部分的起始位置
+	static bool decodeBook(const QByteArray& record, BookInfo& book, bool withDetail, qint64* detailOffset = nullptr);
+	//已保存的书签和阅读记录部分，未编码
+	QByteArray storedDetail(const QString& bookId) const;
+	static QByteArray encodeCategory(const QString& name, const QStringList& bookIds);
+	static bool decodeCategory(const QByteArray& record, QString& name, QStringList& bookIds);
+
+	//写快照，然后删除比generation旧的日志，可以在工作线程中调用
+	static bool writeSnapshot(const QString& filePath, const QHash<QString, QByteArray>& bookRecords,
+		const QMap<QString, QByteArray>& categoryRecords, quint32 generation, QString* error);
+	//某一代日志的路径
+	static QString journalPath(const QString& filePath, quint32 generation);
+	//现有日志的代号，从小到大
+	static QList<quint32> journalGenerations(const QString& filePath);
+
+	//应用快照或日志中的一条记录
+	void applyRecord(quint8 kind, const QByteArray& record);
+	//重放一个日志文件，返回是否完整
+	bool replayJournal(const QString& journalFilePath);
+	//追加一条日志
+	void appendJournal(quint8 kind, const QByteArray& record);
+	//追加已编码的若干条日志
+	void appendJournalEntries(const QByteArray& entries);
+	//换到新一代日志
+	bool openJournal(quint32 generation);
+	//后台压缩
+	void compactAsync();
+
+	QString zFilePath;
+	QHash<QString, QByteArray> zBookRecords;//书籍标识->已编码的记录
+	QMap<QString, QByteArray> zCategoryRecords;//分类名->已编码的记录
+
+	QFile zJournal;//当前一代日志，只追加
+	quint32 zGeneration;//当前日志的代号
+	qint64 zJournalBytes;//当前日志的大小
+	QFuture<bool> zCompaction;//正在进行的后台压缩
+
+	QString zLastError;
+};
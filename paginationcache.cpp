@@ -0,0 +1,133 @@
+#include "paginationcache.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QDebug>
+
+namespace
+{
+	const quint32 kCacheMagic = 0x50474D50;//"PGMP"
+	const quint16 kCacheVersion = 1;
+	const qsizetype kMaxEntries = 8192;//超过后丢弃旧记录，避免无限增长
+}
+
+paginationCache::paginationCache(const QString& bookFilePath)
+	: zBookFilePath(bookFilePath), zDirty(false)
+{
+	//按书籍路径的哈希命名，避免不同目录下同名书籍冲突
+	const QByteArray pathHash = QCryptographicHash::hash(bookFilePath.toUtf8(), QCryptographicHash::Md5).toHex();
+	zCacheFilePath = QDir::currentPath() + "/pagecache/" + QString::fromLatin1(pathHash) + ".cache";
+	load();
+}
+
+paginationCache::~paginationCache()
+{
+	save();
+}
+
+QString paginationCache::bookFilePath() const
+{
+	return zBookFilePath;
+}
+
+QByteArray paginationCache::contentHash(const QString& chapterHtml)
+{
+	return QCryptographicHash::hash(QByteArrayView(reinterpret_cast<const char*>(chapterHtml.constData()), chapterHtml.size() * qsizetype(sizeof(QChar))), QCryptographicHash::Md5);
+}
+
+QByteArray paginationCache::makeKey(const QByteArray& contentHash, const QFont& font, const QSizeF& pageSize)
+{
+	QByteArray key = contentHash;
+	key += font.toString().toUtf8();
+	key += '|' + QByteArray::number(qRound(pageSize.width())) + 'x' + QByteArray::number(qRound(pageSize.height()));
+	return key;
+}
+
+int paginationCache::pageCount(const QByteArray& key) const
+{
+	QMutexLocker locker(&zMutex);
+	return zPageCounts.value(key, -1);
+}
+
+void paginationCache::insert(const QByteArray& key, int pageCount)
+{
+	QMutexLocker locker(&zMutex);
+	auto it = zPageCounts.find(key);
+	if (it != zPageCounts.end() && it.value() == pageCount)
+	{
+		return;
+	}
+	if (it == zPageCounts.end() && zPageCounts.size() >= kMaxEntries)
+	{
+		zPageCounts.clear();
+	}
+	zPageCounts.insert(key, pageCount);
+	zDirty = true;
+}
+
+bool paginationCache::load()
+{
+	QFile file(zCacheFilePath);
+	if (!file.exists())
+	{
+		return false;
+	}
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "could not open pagination cache" << zCacheFilePath << file.errorString();
+		return false;
+	}
+
+	QDataStream in(&file);
+	quint32 magic = 0;
+	quint16 version = 0;
+	in >> magic >> version;
+	if (magic != kCacheMagic || version != kCacheVersion)//格式不符时当作没有缓存
+	{
+		return false;
+	}
+
+	QHash<QByteArray, qint32> pageCounts;
+	in >> pageCounts;
+	if (in.status() != QDataStream::Ok)
+	{
+		qWarning() << "pagination cache is corrupt:" << zCacheFilePath;
+		return false;
+	}
+
+	QMutexLocker locker(&zMutex);
+	zPageCounts = pageCounts;
+	return true;
+}
+
+bool paginationCache::save()
+{
+	QMutexLocker locker(&zMutex);
+	if (!zDirty)
+	{
+		return true;
+	}
+
+	QDir().mkpath(QFileInfo(zCacheFilePath).absolutePath());
+	QSaveFile file(zCacheFilePath);//先写临时文件再替换，中途退出不会留下半个缓存
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		qWarning() << "could not write pagination cache" << zCacheFilePath << file.errorString();
+		return false;
+	}
+
+	QDataStream out(&file);
+	out << kCacheMagic << kCacheVersion << zPageCounts;
+	if (!file.commit())
+	{
+		qWarning() << "could not commit pagination cache" << zCacheFilePath << file.errorString();
+		return false;
+	}
+
+	zDirty = false;
+	return true;
+}
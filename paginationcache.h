@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QFont>
+#include <QSizeF>
+
+//一本书的分页结果缓存，保存在磁盘上，重新打开书籍或回到同一章时不必重新排版
+//按(章节内容哈希, 字体, 页面大小)记录章节页数；每页高度固定，分页位置就是页高的整数倍
+//可以在多个线程同时使用
+class paginationCache
+{
+public:
+	explicit paginationCache(const QString& bookFilePath);
+	~paginationCache();
+	//对应的书籍路径
+	QString bookFilePath() const;
+	//章节内容的哈希
+	static QByteArray contentHash(const QString& chapterHtml);
+	//缓存键
+	static QByteArray makeKey(const QByteArray& contentHash, const QFont& font, const QSizeF& pageSize);
+	//查询页数，没有记录时返回-1
+	int pageCount(const QByteArray& key) const;
+	//记录页数
+	void insert(const QByteArray& key, int pageCount);
+	//有改动时写回磁盘
+	bool save();
+
+private:
+	Q_DISABLE_COPY(paginationCache)
+
+	bool load();
+
+	QString zBookFilePath;
+	QString zCacheFilePath;//缓存文件路径
+
+	mutable QMutex zMutex;
+	QHash<QByteArray, qint32> zPageCounts;//键->页数
+	bool zDirty;//有未保存的改动
+};
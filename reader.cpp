@@ -20,6 +20,38 @@
 #include <QTimer>
 #include <QVariantMap>
 #include <QSettings>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QtMath>
+#include <QTextBlock>
+#include <QAbstractTextDocumentLayout>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDirIterator>
+#include "bookcover.h"
+#include "epubmetadatacache.h"
+#include <limits>
+
+namespace
+{
+    const int kImportBatchSize = 64;//导入时每批写入书库的书数
+
+    //opf元数据中的作者名
+    QStringList metadataAuthors(const QVariantMap& metadata)
+    {
+        QStringList authors;
+        const QList<QVariantMap> creators = metadata.value("authors").value<QList<QVariantMap>>();
+        for (const QVariantMap& creator : creators)
+        {
+            const QString name = creator.value("name").toString();
+            if (!name.isEmpty())
+            {
+                authors.append(name);
+            }
+        }
+        return authors;
+    }
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -29,22 +61,64 @@ MainWindow::MainWindow(QWidget *parent)
     , m_currentFontSize(13) // 默认字体大小
     , zEpubParser(new readerform(this))//初始化epub解析器
     , zChapterDocument(nullptr)//初始化
+    , zBookPaginator(nullptr)//初始化
+    , zBookSearcher(nullptr)//初始化
+    , zFullTextIndex(nullptr)//初始化
+    , zImportWatcher(nullptr)//初始化
+    , zLibraryModel(nullptr)//初始化
     , zCurrentPage(1)//初始化章节页码
     , zTotalPage(1)//初始化总页码
     , zIsScorll(false)//初始化
+    , zLayoutTimer(nullptr)//初始化
+    , zLayoutBlock(-1)//初始化
+    , zTotalPageKnown(true)//初始化
     , recordFilePath("/record")    // 阅读记录文件路径
     , bookmarkFilePath("/bookmarkmessage")    // 书签文件路径
+    , zLibraryStore(libraryStore::defaultPath())    // 书库存储文件
+    , zHasSampledIds(false)//初始化
 {
+    zStartupTimer.start();//统计启动到书库第一次绘制的时间
     ui->setupUi(this);
 
     zTimer = new QTimer(this);//设置计时器
     connect(zTimer, &QTimer::timeout, this, &MainWindow::updateReadTime);
 
+    // 后台打开epub的进度和结果
+    connect(zEpubParser, &readerform::openProgress, this, &MainWindow::onEpubOpenProgress);
+    connect(zEpubParser, &readerform::openFinished, this, &MainWindow::onEpubOpenFinished);
+
 
     /*--------------------------------*/
-    zChapterDocument = new QTextDocument(this);
+    zChapterDocument = new chapterDocument([this](const QString& filePathInZip) {
+        return zEpubParser->getResourceByPath(filePathInZip);
+        }, this);
     ui->readerTextBrowser->setDocument(zChapterDocument);//设置document实例，方便控制属性
 
+    zLayoutTimer = new QTimer(this);//间隔为0，事件队列空闲时触发
+    zLayoutTimer->setInterval(0);
+    connect(zLayoutTimer, &QTimer::timeout, this, &MainWindow::onLayoutSlice);
+
+    zBookPaginator = new bookPaginator(this);//后台计算全书页码
+    connect(zBookPaginator, &bookPaginator::chapterPaginated, this, &MainWindow::onChapterPaginated);
+    connect(zBookPaginator, &bookPaginator::finished, this, &MainWindow::updateBookmarkComboBox);
+
+    zBookSearcher = new bookSearcher(this);//后台书内搜索
+    connect(zBookSearcher, &bookSearcher::hitFound, this, &MainWindow::onBookSearchHit);
+    connect(zBookSearcher, &bookSearcher::progress, this, &MainWindow::onBookSearchProgress);
+    connect(zBookSearcher, &bookSearcher::finished, this, &MainWindow::onBookSearchFinished);
+
+    zFullTextIndex = new fullTextIndex(this);//后台逐本建立全文索引
+    connect(zFullTextIndex, &fullTextIndex::pendingChanged, this, [this](int pendingBooks) {
+        if (pendingBooks > 0)
+        {
+            ui->statusbar->showMessage(tr("正在建立全文索引，剩余 %1 本").arg(pendingBooks));
+        }
+        else
+        {
+            ui->statusbar->showMessage(tr("全文索引已更新"), 3000);
+        }
+        });
+
     /*--------------------------------*/
 
     setupUI();
@@ -55,6 +129,7 @@ MainWindow::MainWindow(QWidget *parent)
     refreshBookLists();
     refreshCategoriesList();
     setupReaderNavigation();
+    ui->allBooksListWidget->viewport()->installEventFilter(this);//第一次绘制后再做后台工作
 
     /*-----------------------------*/
     connect(ui->readerTextBrowser->verticalScrollBar(), &QScrollBar::valueChanged, this, &MainWindow::onReaderScroll);//连接 QTextBrowser 滚动条的 valueChanged 信号
@@ -113,6 +188,19 @@ MainWindow::MainWindow(QWidget *parent)
 }
 bool MainWindow::eventFilter(QObject *watched, QEvent *event)
 {
+    if (watched == ui->allBooksListWidget->viewport() && event->type() == QEvent::Paint)
+    {
+        //书库第一次绘制，界面已经可用；事件处理完后再开始后台工作，不推迟这一帧
+        ui->allBooksListWidget->viewport()->removeEventFilter(this);
+        const qint64 firstFrame = zStartupTimer.elapsed();
+        ui->statusbar->showMessage(tr("启动用时 %1 毫秒").arg(firstFrame), 3000);
+        QTimer::singleShot(0, this, [this]() {
+            zLibraryModel->setCovers(bookCover::scanThumbnails());//封面缩略图
+            zFullTextIndex->syncLibrary(allBooks.keys());//补建上次没完成或书籍已改动的索引
+            });
+        return QMainWindow::eventFilter(watched, event);
+    }
+
     if (ui->contentStackedWidget->currentWidget() == ui->readerPage &&
         watched == ui->readerTextBrowser)
     {
@@ -146,6 +234,12 @@ MainWindow::~MainWindow()
     {
         zTimer->stop();
     }
+    if (zImportWatcher)
+    {
+        zImportWatcher->cancel();//不再开始新的书，等正在读的书结束
+        zImportWatcher->waitForFinished();
+        zImportWatcher = nullptr;
+    }
 
     /*-------------------*/
     saveApplicationState();
@@ -162,7 +256,13 @@ void MainWindow::setupUI()
     connect(ui->searchLineEdit, &QLineEdit::textChanged, this, &MainWindow::on_searchLineEdit_textChanged);
     connect(ui->favSearchLineEdit, &QLineEdit::textChanged, this, &MainWindow::on_favSearchLineEdit_textChanged);
     connect(ui->categorySearchLineEdit, &QLineEdit::textChanged, this, &MainWindow::on_categorySearchLineEdit_textChanged);
+    ui->searchLineEdit->setToolTip(tr("输入时按书名、作者和主题筛选，按回车在全部书籍的正文中搜索"));
     
+    // 全部书籍列表使用模型，排序和搜索由模型维护
+    zLibraryModel = new libraryModel(&allBooks, this);
+    ui->allBooksListWidget->setModel(zLibraryModel);
+    ui->allBooksListWidget->setEditTriggers(QAbstractItemView::NoEditTriggers);
+
     // 自定义书籍列表项样式
     ui->allBooksListWidget->setIconSize(QSize(48, 48));
     ui->favPageListWidget->setIconSize(QSize(48, 48));
@@ -368,55 +468,16 @@ void MainWindow::updateCategoryPage(const QString &categoryName)
 
 void MainWindow::refreshBookLists()
 {
-    // 清空现有列表
-    ui->allBooksListWidget->clear();
-    
-    // 提取所有书籍并进行排序
-    QList<BookInfo> sortedBooks = allBooks.values();
-    
-    // 根据排序方法排序
-    if (m_sortMethod == 0) {
-        // 按名称排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.title < b.title;
-        });
-    } else if (m_sortMethod == 1) {
-        // 按阅读时间排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.totalReadTime > b.totalReadTime;
-        });
-    } else if (m_sortMethod == 2) {
-        // 按最近阅读排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.lastReadTime > b.lastReadTime;
-        });
-    }
-    
-    // 添加所有书籍到全部书籍列表
-    for (const auto &book : sortedBooks) {
-        addBookToList(ui->allBooksListWidget, book);
-    }
+    // 书籍表整体变化时重新载入模型
+    zLibraryModel->reload();
 }
 
 void MainWindow::addBookToList(QListWidget *listWidget, const BookInfo &book)
 {
     QListWidgetItem *item = new QListWidgetItem(listWidget);
     
-    // 计算时间显示格式
-    QString timeStr;
-    int hours = book.totalReadTime.hour();
-    int minutes = book.totalReadTime.minute();
-    
-    if (hours > 0) {
-        timeStr = QString("%1时%2分").arg(hours).arg(minutes);
-    } else {
-        timeStr = QString("%1分").arg(minutes);
-    }
-    
     // 设置显示文本
-    QString displayText = QString("%1\n阅读时间: %2").arg(book.title, timeStr);
-    
-    item->setText(displayText);
+    item->setText(libraryModel::displayText(book));
     item->setData(Qt::UserRole, book.filePath); // 在用户数据中存储文件路径
     
     // 添加默认图标
@@ -426,7 +487,7 @@ void MainWindow::addBookToList(QListWidget *listWidget, const BookInfo &book)
 void MainWindow::sortBooks(int sortMethod)
 {
     m_sortMethod = sortMethod;
-    refreshBookLists();
+    zLibraryModel->setSortMethod(sortMethod);//切换到已排好的顺序
 }
 
 void MainWindow::loadSampleBooks()
@@ -564,9 +625,11 @@ void MainWindow::searchBooks(QListWidget *listWidget, const QString &text, const
             }
         }
     } else {
-        // 否则只显示匹配的书籍
+        // 否则只显示匹配的书籍，匹配结果来自书库索引
+        const QStringList matched = zLibraryModel->searchPaths(text);
+        const QSet<QString> matchedPaths(matched.constBegin(), matched.constEnd());
         for (const QString &path : bookPaths) {
-            if (allBooks.contains(path) && allBooks[path].title.contains(text, Qt::CaseInsensitive)) {
+            if (matchedPaths.contains(path) && allBooks.contains(path)) {
                 addBookToList(listWidget, allBooks[path]);
             }
         }
@@ -583,34 +646,267 @@ void MainWindow::on_windowListWidget_itemClicked(QListWidgetItem *item)
 
 void MainWindow::on_addBookButton_clicked()
 {
-    QString filePath = QFileDialog::getOpenFileName(this, tr("打开电子书"),
+    const QStringList filePaths = QFileDialog::getOpenFileNames(this, tr("打开电子书"),
                                                   "", tr("电子书 (*.epub)"));
-    if (!filePath.isEmpty()) {
-        if (!allBooks.contains(filePath)) {
-            BookInfo newBook;
-            newBook.filePath = filePath;
-            QFileInfo fileInfo(filePath);
-            newBook.title = fileInfo.baseName();
-            newBook.totalReadTime = QTime(0, 0);
-            newBook.isFavorite = false;
-            newBook.lastReadTime = QDateTime::currentDateTime();
-            
-            allBooks[filePath] = newBook;
+    if (!filePaths.isEmpty()) {
+        // 只选了一本时导入后直接打开
+        importBooks(filePaths, filePaths.size() == 1 ? filePaths.first() : QString());
+    }
+}
 
-            /*---------*/
-            /*ensureBookHasCategory(filePath);*/
-            BookInfo& AddedBook = allBooks[filePath];
-            loadBookMarkFile(AddedBook,filePath);
-            loadReadingRecord(AddedBook,filePath);
-            /*---------*/
+void MainWindow::on_importFolderButton_clicked()
+{
+    const QString folderPath = QFileDialog::getExistingDirectory(this, tr("导入文件夹"));
+    if (!folderPath.isEmpty()) {
+        importFolder(folderPath);
+    }
+}
 
-            refreshBookLists();
+void MainWindow::importFolder(const QString& folderPath)
+{
+    ui->statusbar->showMessage(tr("正在查找 %1 中的电子书").arg(folderPath));
+    QFutureWatcher<QStringList>* watcher = new QFutureWatcher<QStringList>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+        watcher->deleteLater();
+        const QStringList filePaths = watcher->result();
+        if (filePaths.isEmpty())
+        {
+            ui->statusbar->showMessage(tr("没有找到电子书"), 3000);
+            return;
         }
-        
-        openBook(filePath);
+        importBooks(filePaths, QString());
+        });
+    watcher->setFuture(QtConcurrent::run([folderPath]() {
+        QStringList filePaths;
+        QDirIterator it(folderPath, { "*.epub" }, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            filePaths.append(it.next());
+        }
+        return filePaths;
+        }));
+}
+
+void MainWindow::importBooks(const QStringList& filePaths, const QString& openPath)
+{
+    QStringList newPaths;
+    for (const QString& filePath : filePaths)
+    {
+        if (!allBooks.contains(filePath))
+        {
+            newPaths.append(filePath);
+        }
+    }
+    if (newPaths.isEmpty())
+    {
+        if (!openPath.isEmpty())
+        {
+            openBook(openPath);
+        }
+        return;
+    }
+    if (zImportWatcher)
+    {
+        ui->statusbar->showMessage(tr("正在导入书籍，请稍后再试"), 3000);
+        return;
+    }
+
+    zImport = importProgress();
+    zImport.openPath = openPath;
+    zImport.total = newPaths.size();
+    zImport.timer.start();
+    ui->statusbar->showMessage(tr("正在导入 %1 本书").arg(zImport.total));
+
+    QFutureWatcher<importedBook>* watcher = new QFutureWatcher<importedBook>(this);
+    zImportWatcher = watcher;
+    connect(watcher, &QFutureWatcherBase::resultsReadyAt, this, [this, watcher](int begin, int end) {
+        if (zImportWatcher != watcher)
+        {
+            return;
+        }
+        for (int i = begin; i < end; ++i)
+        {
+            zImport.pending.append(watcher->resultAt(i));
+        }
+        if (zImport.pending.size() >= kImportBatchSize)
+        {
+            commitImportBatch();
+        }
+        });
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+        watcher->deleteLater();
+        if (zImportWatcher != watcher)
+        {
+            return;
+        }
+        zImportWatcher = nullptr;
+        commitImportBatch();
+
+        const double seconds = qMax<qint64>(1, zImport.timer.elapsed()) / 1000.0;
+        ui->statusbar->showMessage(tr("导入完成：新增 %1 本，移动位置 %2 本，重复 %3 本，每秒 %4 本")
+            .arg(zImport.added).arg(zImport.relocated).arg(zImport.duplicates).arg(zImport.done / seconds, 0, 'f', 1), 5000);
+
+        if (!zImport.openTarget.isEmpty())
+        {
+            openBook(zImport.openTarget);
+        }
+        });
+
+    //每本书在线程池中独立打开，结果按完成的顺序分批取回
+    const bool withSampled = zHasSampledIds;
+    watcher->setFuture(QtConcurrent::mapped(newPaths, [withSampled](const QString& filePath) {
+        return identifyBook(filePath, withSampled);
+        }));
+}
+
+MainWindow::importedBook MainWindow::identifyBook(const QString& filePath, bool withSampled)
+{
+    importedBook imported;
+    imported.filePath = filePath;
+    if (withSampled)//只有书库里还有旧格式标识时才需要
+    {
+        imported.sampledId = bookIdentity::computeSampled(filePath);
+    }
+
+    readerform parser(nullptr);//不能与主窗口共用，每个任务一个
+    const bool opened = parser.openEpub(filePath, MAPPED_ARCHIVE);
+    const QByteArray centralDirectory = opened ? parser.centralDirectory() : QByteArray();
+    //标识直接用已映射的中央目录和已解析的标识符，不再单独打开文件；映射或解析失败时才按路径计算
+    imported.bookId = centralDirectory.isEmpty() ? bookIdentity::compute(filePath) : bookIdentity::compute(centralDirectory, parser.uniqueIdentifier());
+    if (!opened)
+    {
+        qWarning() << "could not read metadata of" << filePath << parser.getLastError();
+        return imported;//仍然导入，书名用文件名
+    }
+
+    const QVariantMap metadata = parser.getMetaDate();
+    imported.title = metadata.value("title").toString();
+    imported.authors = metadataAuthors(metadata);
+    imported.subjects = metadata.value("subjects").toStringList();
+
+    const QString thumbnailPath = bookCover::thumbnailPath(imported.bookId);
+    if (QFileInfo::exists(thumbnailPath) || bookCover::extract(parser, imported.bookId))
+    {
+        imported.thumbnailPath = thumbnailPath;
+    }
+    return imported;
+}
+
+void MainWindow::commitImportBatch()
+{
+    QList<BookInfo> newBooks;
+    for (const importedBook& imported : std::as_const(zImport.pending))
+    {
+        const QString libraryPath = importBook(imported, newBooks);
+        if (imported.filePath == zImport.openPath)
+        {
+            zImport.openTarget = libraryPath;
+        }
+    }
+    zImport.done += zImport.pending.size();
+    zImport.added += newBooks.size();
+    zImport.pending.clear();
+    zLibraryStore.putBooks(newBooks);
+
+    if (zImportWatcher)
+    {
+        const double seconds = qMax<qint64>(1, zImport.timer.elapsed()) / 1000.0;
+        ui->statusbar->showMessage(tr("正在导入 %1/%2 本，每秒 %3 本").arg(zImport.done).arg(zImport.total).arg(zImport.done / seconds, 0, 'f', 1));
     }
 }
 
+QString MainWindow::importBook(const importedBook& imported, QList<BookInfo>& newBooks)
+{
+    const QString& filePath = imported.filePath;
+    if (allBooks.contains(filePath))
+    {
+        return filePath;
+    }
+
+    QString existingPath = zBookPathById.value(imported.bookId);
+    if (existingPath.isEmpty() && !imported.sampledId.isEmpty())
+    {
+        //早先以旧格式标识保存的书，顺便换成新的标识
+        existingPath = zBookPathById.value(imported.sampledId);
+        if (!existingPath.isEmpty())
+        {
+            ensureBookDetail(existingPath);//换键之前读出书签，否则写入时找不到旧记录
+            BookInfo& book = allBooks[existingPath];
+            zLibraryStore.removeBook(book.bookId);
+            zBookPathById.remove(book.bookId);
+            bookCover::remove(book.bookId);//缩略图以新标识重新生成
+            book.bookId = imported.bookId;
+            zBookPathById.insert(book.bookId, existingPath);
+            storeBook(existingPath);
+            for (const QString& category : book.categories)
+            {
+                storeCategory(category);
+            }
+        }
+    }
+
+    if (!existingPath.isEmpty())
+    {
+        if (QFileInfo::exists(existingPath))
+        {
+            ++zImport.duplicates;//同一本书已经在书库中
+            return existingPath;
+        }
+        relocateBook(existingPath, filePath);//原来的文件已不存在，视为移动
+        ++zImport.relocated;
+        return filePath;
+    }
+
+    BookInfo newBook;
+    newBook.filePath = filePath;
+    newBook.bookId = imported.bookId;
+    newBook.title = imported.title.isEmpty() ? QFileInfo(filePath).baseName() : imported.title;
+    newBook.authors = imported.authors;
+    newBook.subjects = imported.subjects;
+    newBook.totalReadTime = QTime(0, 0);
+    newBook.isFavorite = false;
+    newBook.lastReadTime = QDateTime::currentDateTime();
+
+    allBooks[filePath] = newBook;
+    zBookPathById.insert(newBook.bookId, filePath);
+    newBooks.append(newBook);
+
+    if (!imported.thumbnailPath.isEmpty())
+    {
+        zLibraryModel->addCover(newBook.bookId, imported.thumbnailPath);
+    }
+    zLibraryModel->addBook(filePath);
+    zFullTextIndex->addBook(filePath);
+    return filePath;
+}
+
+void MainWindow::relocateBook(const QString& oldPath, const QString& newPath)
+{
+    zLibraryModel->removeBook(oldPath);
+    zFullTextIndex->removeBook(oldPath);//段文件记录了路径，在新位置重建
+    epubMetadataCache::remove(oldPath);//解析缓存按路径命名，在新位置打开时重建
+
+    BookInfo book = allBooks.take(oldPath);
+    book.filePath = newPath;
+    allBooks.insert(newPath, book);
+    zBookPathById.insert(book.bookId, newPath);
+
+    //分类记录的是标识，只需改内存中的路径
+    for (const QString& category : book.categories)
+    {
+        QList<QString>& books = m_categories[category].books;
+        const qsizetype index = books.indexOf(oldPath);
+        if (index >= 0)
+        {
+            books[index] = newPath;
+        }
+    }
+
+    storeBook(newPath);
+    zLibraryModel->addBook(newPath);
+    zFullTextIndex->addBook(newPath);
+}
+
 void MainWindow::on_sortByNameButton_clicked()
 {
     sortBooks(0);
@@ -635,6 +931,10 @@ void MainWindow::on_closeBookButton_clicked()
     }
 
 
+    zBookPaginator->cancel();//不再需要全书页码
+    stopIncrementalLayout();
+    resetBookSearch();
+
     // 关闭书籍时保存书签
     if (!zCurrentBookFikePath.isEmpty())
     {
@@ -662,12 +962,7 @@ void MainWindow::on_bookmarkButton_clicked()
         updateBookmarkComboBox();
         QMessageBox::information(this, "添加书签", QString("已在第 %1 页添加书签").arg(zCurrentPage));
     }*/
-    QString chapterTitle;//章节标题
-    QMap<QString, QString> toc = zEpubParser->getTableofContent();
-    if (toc.contains(zCurrentChapterId))
-    {
-        chapterTitle = toc.value(zCurrentChapterId);
-    }
+    const QString chapterTitle = zEpubParser->getTableOfContents()->chapterTitle(zCurrentChapterId);//章节标题
     bookMark newMark;
     newMark.chapterId = zCurrentChapterId;
     newMark.chapterTitle = chapterTitle;
@@ -675,6 +970,7 @@ void MainWindow::on_bookmarkButton_clicked()
     if (it != allBooks.end())
     {
         it->BookMarks.append(newMark);
+        storeBook(currentFilePath);
         updateBookmarkComboBox();
         QMessageBox::information(this, "添加书签", QString("已在%1 第 %2 页添加书签").arg(chapterTitle).arg(zCurrentPage));
     }
@@ -719,6 +1015,7 @@ void MainWindow::on_addToButton_clicked()
         if (selectedAction == addToFavAction) {
             // 添加到收藏夹
             allBooks[filePath].isFavorite = true;
+            storeBook(filePath);
             QMessageBox::information(this, tr("添加到收藏夹"), 
                                    tr("《%1》已添加到收藏夹").arg(allBooks[filePath].title));
             
@@ -737,6 +1034,7 @@ void MainWindow::on_addToButton_clicked()
             if (!categoryName.isEmpty()) {
                 createCategory(categoryName);
                 addBookToCategory(filePath, categoryName);
+                storeCategory(categoryName);
                 refreshCategoriesList();
                 QMessageBox::information(this, tr("添加到分类"), 
                                        tr("《%1》已添加到分类 %2").arg(allBooks[filePath].title, categoryName));
@@ -745,6 +1043,7 @@ void MainWindow::on_addToButton_clicked()
             // 添加到现有分类
             QString categoryName = selectedAction->data().toString();
             addBookToCategory(filePath, categoryName);
+            storeCategory(categoryName);
             QMessageBox::information(this, tr("添加到分类"), 
                                    tr("《%1》已添加到分类 %2").arg(allBooks[filePath].title, categoryName));
             
@@ -767,6 +1066,7 @@ void MainWindow::on_addCategoryButton_clicked()
                                               tr("请输入分类名称:"));
     if (!categoryName.isEmpty()) {
         createCategory(categoryName);
+        storeCategory(categoryName);
         refreshCategoriesList();
     }
 }
@@ -810,40 +1110,59 @@ void MainWindow::onWindowListContextMenu(const QPoint &pos)
 
 void MainWindow::on_searchLineEdit_textChanged(const QString &text)
 {
-    if (text.isEmpty()) {
-        refreshBookLists();
+    // 只改变模型的过滤条件，不重建列表
+    zLibraryModel->setSearchText(text);
+}
+
+void MainWindow::on_searchLineEdit_returnPressed()
+{
+    const QString text = ui->searchLineEdit->text().trimmed();
+    if (text.isEmpty())
+    {
         return;
     }
-    
-    ui->allBooksListWidget->clear();
-    
-    // 提取所有书籍并进行排序
-    QList<BookInfo> sortedBooks = allBooks.values();
-    
-    // 根据排序方法排序
-    if (m_sortMethod == 0) {
-        // 按名称排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.title < b.title;
-        });
-    } else if (m_sortMethod == 1) {
-        // 按阅读时间排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.totalReadTime > b.totalReadTime;
-        });
-    } else if (m_sortMethod == 2) {
-        // 按最近阅读排序
-        std::sort(sortedBooks.begin(), sortedBooks.end(), [](const BookInfo &a, const BookInfo &b) {
-            return a.lastReadTime > b.lastReadTime;
-        });
+
+    QElapsedTimer timer;
+    timer.start();
+    const QList<fullTextHit> hits = zFullTextIndex->search(text);
+    ui->statusbar->showMessage(tr("正文搜索：%1 条结果，用时 %2 毫秒").arg(hits.size()).arg(timer.elapsed()), 3000);
+    if (hits.isEmpty())
+    {
+        return;
     }
-    
-    // 添加匹配的书籍到列表
-    for (const auto &book : sortedBooks) {
-        if (book.title.contains(text, Qt::CaseInsensitive)) {
-            addBookToList(ui->allBooksListWidget, book);
+
+    //按相关度列出章节，选中后打开书籍并跳到该章
+    QMenu hitMenu(this);
+    for (const fullTextHit& hit : hits)
+    {
+        const QString title = allBooks.contains(hit.bookPath) ? allBooks[hit.bookPath].title : QFileInfo(hit.bookPath).baseName();
+        QString chapterText = hit.chapterLabel;
+        if (chapterText.isEmpty())
+        {
+            chapterText = tr("第 %1 章").arg(hit.chapterIndex + 1);
         }
+        QAction* action = hitMenu.addAction(QString("《%1》 %2").arg(title, chapterText));
+        QVariantMap hitData;
+        hitData["filePath"] = hit.bookPath;
+        hitData["chapterId"] = hit.chapterId;
+        action->setData(hitData);
+    }
+
+    QAction* selectedAction = hitMenu.exec(ui->searchLineEdit->mapToGlobal(QPoint(0, ui->searchLineEdit->height())));
+    if (!selectedAction)
+    {
+        return;
     }
+
+    const QVariantMap hitData = selectedAction->data().toMap();
+    const QString filePath = hitData.value("filePath").toString();
+    if (!allBooks.contains(filePath))
+    {
+        return;
+    }
+    zPendingChapterId = hitData.value("chapterId").toString();
+    zPendingSearchText = text;
+    openBook(filePath);
 }
 
 void MainWindow::on_favSearchLineEdit_textChanged(const QString &text)
@@ -911,6 +1230,8 @@ void MainWindow::onCategoriesListContextMenu(const QPoint &pos)
             
             // 删除旧分类
             m_categories.remove(categoryName);
+            zLibraryStore.removeCategory(categoryName);
+            storeCategory(newName);
             
             // 更新窗口信息
             for (int i = 0; i < m_windows.size(); ++i) {
@@ -936,20 +1257,14 @@ void MainWindow::onCategoriesListContextMenu(const QPoint &pos)
         if (reply == QMessageBox::Yes) {
             for (const QString& path : m_categories[categoryName].books) {
                 if (allBooks.contains(path)) {
-                    // 删除阅读进度文件（record）
-                    QFileInfo fileInfo(path);
-                    QString bookDir = QDir::currentPath() + "/" + categoryName + "/" + fileInfo.baseName();
-                    QFile(recordFilePath).remove(bookDir + "/record"); // 删除阅读记录文件
-
-                    // 删除书签文件（bookmarkmessage）
-                    QFile(bookmarkFilePath).remove(bookDir + "/bookmarkmessage"); // 删除书签文件
-
+                    // 书签和阅读记录属于书籍本身，分类只是引用，不需要删除
                     // 从书籍分类列表中移除该分类
                     allBooks[path].categories.removeAll(categoryName);
                 }
             }
 
             m_categories.remove(categoryName);
+            zLibraryStore.removeCategory(categoryName);
 
             for (int i = 0; i < m_windows.size(); ++i) {
                 if (m_windows[i].type == CATEGORY && m_windows[i].identifier == categoryName) {
@@ -963,10 +1278,10 @@ void MainWindow::onCategoriesListContextMenu(const QPoint &pos)
     }
 }
 
-void MainWindow::on_allBooksListWidget_itemDoubleClicked(QListWidgetItem *item)
+void MainWindow::on_allBooksListWidget_doubleClicked(const QModelIndex &index)
 {
-    if (item) {
-        QString filePath = item->data(Qt::UserRole).toString();
+    if (index.isValid()) {
+        QString filePath = index.data(libraryModel::FilePathRole).toString();
         openBook(filePath);
     }
 }
@@ -1027,11 +1342,41 @@ void MainWindow::openBook(const QString &filePath)
 
     //ensureBookHasCategory(filePath);//确保分类存在
 
-    zEpubParser->closeEpub();//先关闭
-    
-    if (!zEpubParser->openEpub(filePath))
+    // 在后台解析epub，解析完成后由onEpubOpenFinished继续打开流程
+    // 再次打开其他书籍时openEpubAsync会取消上一次未完成的解析
+    zOpeningBookPath = filePath;
+    zEpubParser->openEpubAsync(filePath, MAPPED_ARCHIVE);
+    ui->statusbar->showMessage(tr("正在打开：《%1》").arg(allBooks[filePath].title));
+}
+
+void MainWindow::onEpubOpenProgress(int percent)
+{
+    if (!zOpeningBookPath.isEmpty() && allBooks.contains(zOpeningBookPath))
+    {
+        ui->statusbar->showMessage(tr("正在打开：《%1》 %2%").arg(allBooks[zOpeningBookPath].title).arg(percent));
+    }
+}
+
+void MainWindow::onEpubOpenFinished(bool success)
+{
+    const QString filePath = zOpeningBookPath;
+    zOpeningBookPath.clear();
+
+    //从全文搜索打开时要跳转的章节和搜索的文字，只对这一次打开有效
+    const QString pendingChapterId = zPendingChapterId;
+    const QString searchText = zPendingSearchText;
+    zPendingChapterId.clear();
+    zPendingSearchText.clear();
+
+    if (filePath.isEmpty() || !allBooks.contains(filePath)) {
+        return;
+    }
+
+    if (!success)
     {
         QMessageBox::critical(this, tr("failure occur when open epub file"), tr("could open epub file%1,error:%2").arg(filePath).arg(zEpubParser->getLastError()));
+        zEpubParser->closeEpub();//与同步打开失败时的状态保持一致
+        zBookPaginator->cancel();
 
         zCurrentBookFikePath.clear();//清空路径
         if (zChapterDocument)
@@ -1045,6 +1390,7 @@ void MainWindow::openBook(const QString &filePath)
     }
 
     zCurrentBookFikePath = filePath;
+    ensureBookDetail(filePath);//书签和阅读记录在打开时才读出
     QVariantMap metadata = zEpubParser->getMetaDate();//获取元数据
     QString epubTitle = metadata.value("title", QFileInfo(filePath).baseName()).toString();//获取标题
 
@@ -1053,9 +1399,13 @@ void MainWindow::openBook(const QString &filePath)
         epubTitle = QFileInfo(filePath).baseName();//使用文件名作为标题
     }
 
-    if (allBooks.contains(filePath))//更新标题
+    if (allBooks.contains(filePath))//更新标题、作者和主题，供书库搜索使用
     {
-        allBooks[filePath].title = epubTitle;
+        BookInfo& openedBook = allBooks[filePath];
+        openedBook.title = epubTitle;
+
+        openedBook.authors = metadataAuthors(metadata);
+        openedBook.subjects = metadata.value("subjects").toStringList();
     }
 
     QList<SpineItem> spine = zEpubParser->getSpineItem();
@@ -1085,6 +1435,7 @@ void MainWindow::openBook(const QString &filePath)
     
     /*---------*/
     updateBookmarkComboBox();//更新书签信息
+    resetBookSearch();//上一本书的搜索结果作废
     /*---------*/
 
     // 检查是否已经打开了这本书
@@ -1102,6 +1453,8 @@ void MainWindow::openBook(const QString &filePath)
     switchToWindow(m_windows.size() - 1);
 
     book.lastReadTime = QDateTime::currentDateTime();
+    zLibraryModel->bookChanged(filePath);//标题和最近阅读时间已更新
+    storeBook(filePath);
 
     /*ui->pageSlider->setValue(1);*/
 
@@ -1179,11 +1532,18 @@ void MainWindow::openBook(const QString &filePath)
         chapterLoad = zCurrentBookSpineId.first();
         pageLoad = 1;
     }
+
+    //从全文搜索打开时跳到命中的章节，再用书内搜索定位到页
+    if (!pendingChapterId.isEmpty() && zCurrentBookSpineId.contains(pendingChapterId))
+    {
+        chapterLoad = pendingChapterId;
+        pageLoad = 1;
+    }
     /*----------------------------*/
 
     if (!chapterLoad.isEmpty())
     {
-        QTimer::singleShot(0, this, [this, chapterLoad, pageLoad] {
+        QTimer::singleShot(0, this, [this, chapterLoad, pageLoad, searchText] {
             QFont currentFont = zChapterDocument->defaultFont();
             if (currentFont.pointSize() != m_currentFontSize)
             {
@@ -1194,6 +1554,11 @@ void MainWindow::openBook(const QString &filePath)
             loadChapter(chapterLoad);
             goToPage(pageLoad);
             zTimer->start(60000);//1分钟统计一次
+            if (!searchText.isEmpty())
+            {
+                ui->bookSearchLineEdit->setText(searchText);
+                on_bookSearchLineEdit_returnPressed();
+            }
             });
     }
 
@@ -1697,7 +2062,20 @@ void MainWindow::on_pageSlider_valueChanged(int value)
 
     if (zChapterDocument && !zCurrentChapterId.isEmpty())
     {
-        goToPage(value);
+        int chapterIndex = -1;
+        int pageInChapter = 1;
+        if (isBookPaging() && zBookPaginator->pageMap().locate(value, chapterIndex, pageInChapter))//滑块为全书页码
+        {
+            if (zCurrentBookSpineId[chapterIndex] != zCurrentChapterId)
+            {
+                loadChapter(zCurrentBookSpineId[chapterIndex]);
+            }
+            goToPage(pageInChapter);
+        }
+        else
+        {
+            goToPage(value);
+        }
     }
 }
 
@@ -1756,6 +2134,7 @@ void MainWindow::loadChapter(const QString& itemId)
 
     zCurrentChapterId = itemId;
     QString chapterHtml = zEpubParser->getContentById(itemId);
+    zChapterDocument->setChapterPath(zEpubParser->getContentPathById(itemId));//图片相对于章节路径加载
 
     if (chapterHtml.isEmpty())
     {
@@ -1779,6 +2158,7 @@ void MainWindow::loadChapter(const QString& itemId)
     zChapterDocument->setDefaultFont(currentFont);
 
     zChapterDocument->setHtml(chapterHtml);
+    zCurrentChapterHash = paginationCache::contentHash(chapterHtml);
 
     updatePagination();
 
@@ -1786,6 +2166,18 @@ void MainWindow::loadChapter(const QString& itemId)
 
     zCurrentBookItemIndex = zCurrentBookSpineId.indexOf(itemId);//更新索引
 
+    // 在后台预读相邻章节，优先预读下一章
+    QStringList adjacentIds;
+    if (zCurrentBookItemIndex >= 0 && zCurrentBookItemIndex < zCurrentBookSpineId.size() - 1)
+    {
+        adjacentIds.append(zCurrentBookSpineId[zCurrentBookItemIndex + 1]);
+    }
+    if (zCurrentBookItemIndex > 0)
+    {
+        adjacentIds.append(zCurrentBookSpineId[zCurrentBookItemIndex - 1]);
+    }
+    zEpubParser->prefetchContent(adjacentIds);
+
     zIsScorll = false;
 
     QGraphicsOpacityEffect* effect = qobject_cast<QGraphicsOpacityEffect*>(ui->readerTextBrowser->graphicsEffect());
@@ -1824,6 +2216,8 @@ void MainWindow::updatePagination()
         zChapterDocument->setDefaultFont(docFont);
     }
 
+    stopIncrementalLayout();
+
     QSizeF viewPointSize = ui->readerTextBrowser->viewport()->size();
     if (viewPointSize.height() <= 0 || viewPointSize.width() <= 0)
     {
@@ -1832,10 +2226,36 @@ void MainWindow::updatePagination()
     else
     {
         zChapterDocument->setPageSize(viewPointSize);
-        zTotalPage = zChapterDocument->pageCount();
-        if (zTotalPage == 0)
+
+        int cachedPage = -1;
+        if (!zCurrentBookFikePath.isEmpty())
         {
-            zTotalPage = 1;//至少一页
+            //字体或页面大小变化时重新计算全书页码
+            zBookPaginator->paginate(zEpubParser->readSnapshot(), zCurrentBookSpineId, zChapterDocument->defaultFont(), viewPointSize);
+            cachedPage = zBookPaginator->cachedPageCount(zCurrentChapterHash);
+        }
+
+        if (cachedPage > 0)//同样的内容、字体和页面大小排过版，页数直接可用
+        {
+            zTotalPage = cachedPage;
+            zTotalPageKnown = true;
+            if (!zCurrentBookFikePath.isEmpty())
+            {
+                zBookPaginator->setChapterPageCount(zCurrentBookSpineId.indexOf(zCurrentChapterId), zTotalPage, zCurrentChapterHash);
+            }
+        }
+        else
+        {
+            //页数未知，随分段排版增加
+            zTotalPage = 1;
+            zTotalPageKnown = false;
+        }
+
+        //先只排出第一页，其余部分在空闲时分段排版，跳页时再补排到目标页
+        zLayoutBlock = 0;
+        if (!layoutChapterUntil(viewPointSize.height(), -1))
+        {
+            zLayoutTimer->start();
         }
     }
 
@@ -1848,15 +2268,114 @@ void MainWindow::updatePagination()
         zCurrentPage = 1;//确保从第一页开始
     }
 
+    // 更新页码显示
+    updatePageIndicator();
+}
+
+bool MainWindow::layoutChapterUntil(qreal y, int budgetMs)
+{
+    if (zLayoutBlock < 0)
+    {
+        return true;
+    }
+
+    QAbstractTextDocumentLayout* layout = zChapterDocument->documentLayout();
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    //blockBoundingRect只会把文档排版到该块为止
+    qreal bottom = 0;
+    QTextBlock block = zChapterDocument->findBlockByNumber(zLayoutBlock);
+    while (block.isValid())
+    {
+        bottom = qMax(bottom, layout->blockBoundingRect(block).bottom());
+        block = block.next();
+        if (bottom >= y || (budgetMs >= 0 && elapsed.elapsed() >= budgetMs))
+        {
+            break;
+        }
+    }
+    zLayoutBlock = block.isValid() ? block.blockNumber() : -1;
+
+    if (zLayoutBlock < 0)//排完后得到准确页数
+    {
+        zTotalPage = qMax(1, zChapterDocument->pageCount());
+        zTotalPageKnown = true;
+        if (!zCurrentBookFikePath.isEmpty())
+        {
+            //当前章节以界面排版结果为准
+            zBookPaginator->setChapterPageCount(zCurrentBookSpineId.indexOf(zCurrentChapterId), zTotalPage, zCurrentChapterHash);
+        }
+    }
+    else
+    {
+        const qreal pageHeight = zChapterDocument->pageSize().height();
+        if (pageHeight > 0)
+        {
+            zTotalPage = qMax(zTotalPage, qCeil(bottom / pageHeight));
+        }
+    }
+
+    updatePageIndicator();
+    return zLayoutBlock < 0;
+}
+
+void MainWindow::onLayoutSlice()
+{
+    if (!zChapterDocument || layoutChapterUntil(std::numeric_limits<qreal>::max(), 8))//每次最多占用8毫秒
+    {
+        zLayoutTimer->stop();
+    }
+}
+
+void MainWindow::stopIncrementalLayout()
+{
+    zLayoutTimer->stop();
+    zLayoutBlock = -1;
+}
+
+bool MainWindow::isBookPaging() const
+{
+    return zBookPaginator && zBookPaginator->pageMap().isComplete() && zCurrentBookSpineId.contains(zCurrentChapterId);
+}
+
+void MainWindow::updatePageIndicator()
+{
+    int currentPage = zCurrentPage;
+    int totalPage = zTotalPage;
+    if (isBookPaging())//全书分页完成后显示全书页码
+    {
+        const bookPageMap& pageMap = zBookPaginator->pageMap();
+        currentPage = pageMap.bookPage(zCurrentBookSpineId.indexOf(zCurrentChapterId), zCurrentPage);
+        totalPage = pageMap.totalPages();
+    }
+
+    const bool wasScorll = zIsScorll;
     zIsScorll = true;
-    ui->pageSlider->setRange(1, zTotalPage);
-    ui->pageSlider->setValue(zCurrentPage);
-    ui->pageSlider->setEnabled(zTotalPage > 1);
-    zIsScorll = false;
+    ui->pageSlider->setRange(1, qMax(1, totalPage));
+    ui->pageSlider->setValue(currentPage);
+    ui->pageSlider->setEnabled(totalPage > 1);
+    zIsScorll = wasScorll;
 
-    // 更新页码显示
-    ui->currentPageLabel->setText(QString::number(zCurrentPage));
-    ui->totalPagesLabel->setText(QString::number(zTotalPage));
+    ui->currentPageLabel->setText(QString::number(currentPage));
+    if (zLayoutBlock >= 0 && !zTotalPageKnown && !isBookPaging())//仍在排版，总页数还会增加
+    {
+        ui->totalPagesLabel->setText(QString("%1+").arg(totalPage));
+    }
+    else
+    {
+        ui->totalPagesLabel->setText(QString::number(totalPage));
+    }
+}
+
+void MainWindow::onChapterPaginated(int chapterIndex, int pageCount)
+{
+    Q_UNUSED(chapterIndex);
+    Q_UNUSED(pageCount);
+    if (!zCurrentChapterId.isEmpty())
+    {
+        updatePageIndicator();
+    }
 }
 
 void MainWindow::goToPage(int pageNum)
@@ -1866,6 +2385,11 @@ void MainWindow::goToPage(int pageNum)
         return;
     }
 
+    if (zLayoutBlock >= 0)//目标页可能还没排到（页数来自缓存时也一样），先排版到该页再滚动
+    {
+        layoutChapterUntil(pageNum * zChapterDocument->pageSize().height(), -1);
+    }
+
     int targetPage = qBound(1, pageNum, zTotalPage);//确保在范围内
 
     zCurrentPage = targetPage;
@@ -1873,12 +2397,7 @@ void MainWindow::goToPage(int pageNum)
     qreal PageHight = zChapterDocument->pageSize().height();
     if (PageHight <= 0)
     {
-        if (ui->pageSlider->value() != zCurrentPage)
-        {
-            zIsScorll = true;
-            ui->pageSlider->setValue(zCurrentPage);
-            zIsScorll = false;
-        }
+        updatePageIndicator();
         return;
     }
 
@@ -1886,14 +2405,10 @@ void MainWindow::goToPage(int pageNum)
 
     zIsScorll = true;
     ui->readerTextBrowser->verticalScrollBar()->setValue(scrollPos);
-    if (ui->pageSlider->value() != zCurrentPage)
-    {
-        ui->pageSlider->setValue(zCurrentPage);
-    }
     zIsScorll = false;
 
     //更新页码
-    ui->currentPageLabel->setText(QString::number(zCurrentPage));
+    updatePageIndicator();
 }
 
 void MainWindow::onReaderScroll()
@@ -1918,12 +2433,9 @@ void MainWindow::onReaderScroll()
     if (newPage != zCurrentPage)
     {
         zCurrentPage = newPage;
-        zIsScorll = true;
-        ui->pageSlider->setValue(newPage);
-        zIsScorll = false;
     }
     //更新页码
-    ui->currentPageLabel->setText(QString::number(zCurrentPage));
+    updatePageIndicator();
 }
 
 // 更新书签下拉框
@@ -1955,9 +2467,15 @@ void MainWindow::updateBookmarkComboBox()
             return bookm1.pageInChapter < bookm2.pageInChapter;
             });
             
+        const bookPageMap& pageMap = zBookPaginator->pageMap();
         for (const auto& bookmark : sortBookMark)
         {
             QString itemText = QString("%1 第 %2 页").arg(bookmark.chapterTitle).arg(bookmark.pageInChapter);
+            int bookPage = pageMap.isComplete() ? pageMap.bookPage(zCurrentBookSpineId.indexOf(bookmark.chapterId), bookmark.pageInChapter) : 0;
+            if (bookPage > 0)//全书分页完成后附带全书页码
+            {
+                itemText += QString("（全书第 %1 页）").arg(bookPage);
+            }
             QVariantMap bookMarkData;
             bookMarkData["chapterId"] = bookmark.chapterId;
             bookMarkData["pageInChapter"] = bookmark.pageInChapter;
@@ -1981,60 +2499,102 @@ void MainWindow::on_bookmarkComboBox_currentIndexChanged(int index)
         QString chapter = markDataMap.value("chapterId").toString();
         int page = markDataMap.value("pageInChapter").toInt();
         
-        if (chapter != zCurrentChapterId)
-        {
-            loadChapter(chapter);
-        }
+        jumpToChapterPage(chapter, page);
+    }
+}
 
-        if (chapter == zCurrentChapterId)
-        {
-            QTimer::singleShot(0, this, [this, page]() {
-                goToPage(page);
-                });
-        }
+void MainWindow::jumpToChapterPage(const QString& chapterId, int pageInChapter)
+{
+    if (chapterId != zCurrentChapterId)
+    {
+        loadChapter(chapterId);
+    }
+
+    if (chapterId == zCurrentChapterId)
+    {
+        //goToPage会先把章节排版到目标页再滚动，页数来自缓存时同样适用
+        QTimer::singleShot(0, this, [this, chapterId, pageInChapter]() {
+            if (zCurrentChapterId == chapterId)//跳转前又切换了章节时不再滚动
+            {
+                goToPage(pageInChapter);
+            }
+            });
     }
 }
 
-void MainWindow::saveReadingRecord(const QString& filePath) {
-    if (!allBooks.contains(filePath)) return;
+void MainWindow::resetBookSearch()
+{
+    zBookSearcher->cancel();
+    ui->searchResultComboBox->clear();
+    ui->searchResultComboBox->addItem(tr("搜索结果"), QVariant()); // 添加默认选项
+}
 
-    BookInfo& book = allBooks[filePath];
-    book.lastReadRecord.chapterId = zCurrentChapterId;
-    book.lastReadRecord.chapterTitle = zChapterDocument->metaInformation(QTextDocument::DocumentTitle);
-    book.lastReadRecord.pageInChapter = zCurrentPage;
-    ensureBookHasCategory(filePath); // 确保书籍有分类
-    QFileInfo fileInfo(filePath);
-    QString bookBaseName = fileInfo.baseName();
-    bool savedToAnyCategory = false;
+void MainWindow::on_bookSearchLineEdit_returnPressed()
+{
+    resetBookSearch();
 
-    // 遍历所有分类，保存到每个有效分类
-    for (const QString& category : book.categories) {
-        if (m_categories.contains(category)) {
-            QString categoryDir = QDir::currentPath() + "/" + category;
-            QDir().mkpath(categoryDir);
-            QString recordFilePath = categoryDir + "/" + bookBaseName + this->recordFilePath;
-            QFile recordFile(recordFilePath);
+    const QString text = ui->bookSearchLineEdit->text().trimmed();
+    if (text.isEmpty() || zCurrentBookFikePath.isEmpty())
+    {
+        return;
+    }
 
-            if (recordFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-                QTextStream out(&recordFile);
-                out << book.lastReadRecord.chapterId << "\n";
-                out << book.lastReadRecord.chapterTitle << "\n";
-                out << book.lastReadRecord.pageInChapter;
-                recordFile.close();
-                qDebug() << "Successfully saved reading history to category!" << category;
-                savedToAnyCategory = true;
-            }
-            else {
-                qWarning() << "Unable to save to category!" << category << " wrong!" << recordFile.errorString();
-            }
-        }
+    //按当前的字体和页面大小计算命中所在的页
+    zBookSearcher->search(zEpubParser->readSnapshot(), zCurrentBookSpineId, text,
+        zChapterDocument->defaultFont(), ui->readerTextBrowser->viewport()->size());
+    ui->statusbar->showMessage(tr("正在搜索：%1").arg(text));
+}
+
+void MainWindow::onBookSearchHit(const bookSearchHit& hit)
+{
+    QString chapterTitle = zEpubParser->getTableOfContents()->chapterTitle(hit.chapterId);
+    if (chapterTitle.isEmpty())
+    {
+        chapterTitle = tr("第 %1 章").arg(hit.chapterIndex + 1);
     }
 
-    // 若未找到有效分类，输出错误信息并返回
-    if (!savedToAnyCategory) {
-        qWarning() << "No valid category found, please classify first!";
-        return;
+    QString itemText = QString("%1 第 %2 页：%3").arg(chapterTitle).arg(hit.pageInChapter).arg(hit.snippet);
+    QVariantMap hitData;
+    hitData["chapterId"] = hit.chapterId;
+    hitData["pageInChapter"] = hit.pageInChapter;
+    ui->searchResultComboBox->addItem(itemText, QVariant::fromValue(hitData));
+}
+
+void MainWindow::onBookSearchProgress(int searchedChapters, int totalChapters)
+{
+    ui->statusbar->showMessage(tr("正在搜索：%1/%2 章，%3 条结果").arg(searchedChapters).arg(totalChapters).arg(ui->searchResultComboBox->count() - 1));
+}
+
+void MainWindow::onBookSearchFinished(int hitCount)
+{
+    ui->statusbar->showMessage(tr("搜索完成，共 %1 条结果").arg(hitCount), 3000);
+}
+
+void MainWindow::on_searchResultComboBox_currentIndexChanged(int index)
+{
+    if (index <= 0) return; // 忽略默认选项
+
+    QVariant hitData = ui->searchResultComboBox->itemData(index);
+    if (hitData.canConvert<QVariantMap>())
+    {
+        QVariantMap hitDataMap = hitData.toMap();
+        jumpToChapterPage(hitDataMap.value("chapterId").toString(), hitDataMap.value("pageInChapter").toInt());
+    }
+}
+
+void MainWindow::saveReadingRecord(const QString& filePath) {
+    if (!allBooks.contains(filePath)) return;
+
+    ensureBookDetail(filePath);//没有读出时写入会丢掉已保存的书签
+    BookInfo& book = allBooks[filePath];
+    book.lastReadRecord.chapterId = zCurrentChapterId;
+    book.lastReadRecord.chapterTitle = zEpubParser->getTableOfContents()->chapterTitle(zCurrentChapterId);
+    if (book.lastReadRecord.chapterTitle.isEmpty())//不在目录中的章节用文档标题
+    {
+        book.lastReadRecord.chapterTitle = zChapterDocument->metaInformation(QTextDocument::DocumentTitle);
     }
+    book.lastReadRecord.pageInChapter = zCurrentPage;
+    storeBook(filePath);//阅读记录和书籍信息在同一条记录中
 }
 
 // 从第一个有效分类加载记录
@@ -2087,75 +2647,86 @@ void MainWindow::loadReadingRecord(BookInfo& book,const QString & filePath){
 void MainWindow::saveBookmarkInfo(const QString& filePath) {
     if (!allBooks.contains(filePath)) return;
 
-    BookInfo& book = allBooks[filePath];
-    ensureBookHasCategory(filePath); // 确保书籍有分类
-
-    QFileInfo fileInfo(filePath);
-    QString bookBaseName = fileInfo.baseName();
-    bool savedToAnyCategory = false; // 标记是否成功保存到任何分类
-
-    // 遍历所有分类，保存到每个有效分类
-    for (const QString& category : book.categories) {
-        if (m_categories.contains(category)) {
-            QString categoryDir = QDir::currentPath() + "/" + category;
-            QString bookDir = categoryDir + "/" + bookBaseName;
-
-            // 创建书籍目录（若不存在）
-            QDir().mkpath(bookDir);
-            QString bookmarkFilePath = bookDir + this->bookmarkFilePath; // 完整书签路径
-            QFile bookmarkFile(bookmarkFilePath);
-
-            // 写入书签数据
-            if (bookmarkFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-                QTextStream out(&bookmarkFile);
-
-                for (const bookMark& bookmark : book.BookMarks) {
-                    out << bookmark.chapterId << "\n";
-                    out << bookmark.chapterTitle << "\n";
-                    out << bookmark.pageInChapter << "\n";
-                }
-
-                bookmarkFile.close();
-                qDebug() << "Bookmark Succeed!:" << category << " file path:" << bookmarkFilePath;
-                savedToAnyCategory = true;
-            }
-            else {
-                qWarning() << "Bookmark Fail!" << category << " Wrong!" << bookmarkFile.errorString();
-            }
-        }
-    }
-
-        // 若未保存到任何分类，输出警告
-    if (!savedToAnyCategory) {
-        qWarning() << "No valid category found, unable to save bookmark file!";
-    }
+    storeBook(filePath);//书签和书籍信息在同一条记录中
 }
 
 //创建未分类分类
-void MainWindow::ensureBookHasCategory(const QString& filePath)
+bool MainWindow::ensureBookHasCategory(const QString& filePath)
 {
-    if (!allBooks.contains(filePath)) return;
+    if (!allBooks.contains(filePath)) return false;
     BookInfo& book = allBooks[filePath];
     if (book.categories.isEmpty()) {
             QString uncategorized = "未分类";
         createCategory(uncategorized);
         addBookToCategory(filePath, uncategorized);
+        return true;
     }
+    return false;
 }
 /*----------------------------------------------------*/
 void MainWindow::saveApplicationState()
 {
-    /*-------------*/
-    QSettings setting("MyReaderOrg", "MyReaderApp");
-    saveBookResigtry(setting);
-    saveCategoryState(setting);
-    /*-------------*/
-
     if (!zCurrentBookFikePath.isEmpty() && allBooks.contains(zCurrentBookFikePath))
     {
         saveReadingRecord(zCurrentBookFikePath);
         saveBookmarkInfo(zCurrentBookFikePath);
     }
+    // 其余的修改在发生时已经写入书库日志，退出时不再整体保存
+}
+
+void MainWindow::ensureBookDetail(const QString& filePath)
+{
+    auto it = allBooks.find(filePath);
+    if (it != allBooks.end() && !it->detailLoaded)
+    {
+        zLibraryStore.loadBookDetail(it.value());
+    }
+}
+
+void MainWindow::indexBookIds()
+{
+    zBookPathById.clear();
+    zBookPathById.reserve(allBooks.size());
+    zHasSampledIds = false;
+    for (auto it = allBooks.cbegin(); it != allBooks.cend(); ++it)
+    {
+        zBookPathById.insert(it.value().bookId, it.key());
+        if (it.value().bookId.startsWith("md5:"))
+        {
+            zHasSampledIds = true;
+        }
+    }
+}
+
+void MainWindow::storeBook(const QString& filePath)
+{
+    auto it = allBooks.constFind(filePath);
+    if (it != allBooks.constEnd())
+    {
+        zLibraryStore.putBook(it.value());
+    }
+}
+
+void MainWindow::storeCategory(const QString& categoryName)
+{
+    auto it = m_categories.constFind(categoryName);
+    if (it == m_categories.constEnd())
+    {
+        return;
+    }
+
+    // 分类只记录书籍的稳定标识
+    QStringList bookIds;
+    bookIds.reserve(it.value().books.size());
+    for (const QString& bookPath : it.value().books)
+    {
+        auto book = allBooks.constFind(bookPath);
+        if (book != allBooks.constEnd())
+        {
+            bookIds.append(book.value().bookId);
+        }
+    }
+    zLibraryStore.putCategory(categoryName, bookIds);
 }
 
 void MainWindow::loadBookMarkFile(BookInfo& book, const QString& filePath)
@@ -2222,29 +2793,64 @@ void MainWindow::loadAllBookData()
 
 void MainWindow::loadApplicationState()
 {
-    QSettings setting("MyReaderOrg", "MyReaderApp");
-    qDebug() << "setting file path" << setting.fileName();
-    loadBookResigtry(setting);
-    loadCategotyState(setting);
+    if (!zLibraryStore.exists())
+    {
+        migrateLegacyState();
+        return;
+    }
 
-    loadAllBookData();//替换构造函数的loadAllBookData
+    QMap<QString, QStringList> categories;
+    if (!zLibraryStore.load(allBooks, categories))
+    {
+        qWarning() << "could not load library:" << zLibraryStore.getLastError();
+        return;
+    }
+
+    indexBookIds();
+    for (auto it = categories.cbegin(); it != categories.cend(); ++it)
+    {
+        createCategory(it.key());
+        for (const QString& bookId : it.value())
+        {
+            addBookToCategory(zBookPathById.value(bookId), it.key());
+        }
+    }
+
+    bool uncategorizedChanged = false;
+    for (auto it = allBooks.cbegin(); it != allBooks.cend(); ++it)
+    {
+        uncategorizedChanged = ensureBookHasCategory(it.key()) || uncategorizedChanged;//确保包含分类
+    }
+    if (uncategorizedChanged)//只有新加入了没有分类的书时才写日志
+    {
+        storeCategory("未分类");
+    }
 }
 
-void MainWindow::saveBookResigtry(QSettings& setting)
+void MainWindow::migrateLegacyState()
 {
-    setting.beginGroup("AllBookResigtry");
-    setting.setValue("paths", QVariant::fromValue(allBooks.keys()));
-    setting.endGroup();
+    QSettings setting("MyReaderOrg", "MyReaderApp");
+    qDebug() << "migrating library from" << setting.fileName();
+    loadBookResigtry(setting);
+    loadCategotyState(setting);
+
+    loadAllBookData();//书签和阅读记录还在分类目录下
 
-    for (const QString& path : allBooks.keys())
+    const QStringList bookIds = bookIdentity::computeAll(allBooks.keys());//并行计算，顺序与keys一致
+    int index = 0;
+    for (auto it = allBooks.begin(); it != allBooks.end(); ++it)
     {
-        const BookInfo& book = allBooks[path];
-        setting.beginGroup("BookDetail/" + QFileInfo(path).fileName());
-        setting.setValue("title", book.title);
-        setting.setValue("isFavorite", book.isFavorite);
-        setting.setValue("totalReadTime", book.totalReadTime);
-        setting.setValue("lastReadTime", book.lastReadTime);
-        setting.endGroup();
+        it.value().bookId = bookIds.at(index++);
+        zLibraryStore.putBook(it.value());
+    }
+    indexBookIds();
+    for (auto it = m_categories.cbegin(); it != m_categories.cend(); ++it)
+    {
+        storeCategory(it.key());
+    }
+    if (!zLibraryStore.save())
+    {
+        qWarning() << "could not save library:" << zLibraryStore.getLastError();
     }
 }
 
@@ -2261,6 +2867,8 @@ void MainWindow::loadBookResigtry(QSettings& setting)
             BookInfo book;
             book.filePath = path;
             book.title = setting.value("title").toString();
+            book.authors = setting.value("authors").toStringList();
+            book.subjects = setting.value("subjects").toStringList();
             book.isFavorite = setting.value("isFavorite",false).toBool();
             book.totalReadTime = setting.value("totalReadTime",QTime(0,0)).toTime();
             book.lastReadTime = setting.value("lastReadTime",QDateTime::currentDateTime()).toDateTime();
@@ -2270,20 +2878,6 @@ void MainWindow::loadBookResigtry(QSettings& setting)
         }
 }
 
-void MainWindow::saveCategoryState(QSettings& setting)
-{
-    setting.beginGroup("categorys");
-    setting.remove("");
-    setting.setValue("names", QVariant::fromValue(m_categories.keys()));
-
-    for (auto it = m_categories.begin(); it != m_categories.end(); ++it)
-    {
-        setting.setValue(it.key() + "/books" ,QVariant::fromValue(it.value().books));
-    }
-
-    setting.endGroup();
-}
-
 void MainWindow::loadCategotyState(QSettings& setting)
 {
     setting.beginGroup("categorys");
@@ -2312,55 +2906,21 @@ void MainWindow::removeBookFromCategory(const QString &filePath, const QString &
         allBooks[filePath].categories.removeAll(categoryName);
     }
     
-    //将书籍从该分类下的注册表中移除
-    QSettings setting("MyReaderOrg", "MyReaderApp");
-    setting.beginGroup("categorys");
-    QStringList bookPathList = setting.value(categoryName + "/books").toStringList();
-    bookPathList.removeAll(filePath);
-    setting.setValue(categoryName + "/books", QVariant::fromValue(bookPathList));
-    setting.endGroup();
+    //将书籍从该分类的记录中移除
+    storeCategory(categoryName);
 
-    
-    //如果书籍不属于任何一个分类则把书籍从总注册表中删除
+    //如果书籍不属于任何一个分类则把书籍从书库中删除
     if (allBooks[filePath].categories.isEmpty())
     {
-        //先移除路径
-        setting.beginGroup("AllBookResigtry");
-        QStringList bookPaths = setting.value("paths").toStringList();
-        bookPaths.removeAll(filePath);
-        setting.setValue("paths", QVariant::fromValue(bookPaths));
-        setting.endGroup();
-        //再移除详细信息  
-        setting.beginGroup("BookDetail/" + QFileInfo(filePath).baseName());
-        setting.clear();
-        setting.endGroup();
+        zLibraryStore.removeBook(allBooks[filePath].bookId);
+        zBookPathById.remove(allBooks[filePath].bookId);
+        bookCover::remove(allBooks[filePath].bookId);
         allBooks.remove(filePath);
-
+        zFullTextIndex->removeBook(filePath);
+        epubMetadataCache::remove(filePath);
     }
-    setting.sync();
     refreshBookLists();
 
-    QFileInfo fileInfo(filePath);
-    QString bookBaseName = fileInfo.baseName();
-    QString categoryDir = QDir::currentPath() + "/" + categoryName;
-    QString bookDirPath = categoryDir + "/" + bookBaseName;
-    // 删除阅读记录文件
-    QDir bookDir(bookDirPath);
-    bookDir.removeRecursively();
-    //QFile recordFile(bookDir + recordFilePath);
-    //if (recordFile.exists())
-    //{
-    //    recordFile.remove();
-    //    qDebug() << "Successfully removed reading record from category:" << categoryName;
-    //}
-    //// 删除书签文件
-    //QFile bookmarkFile(bookDir + bookmarkFilePath);
-    //if (bookmarkFile.exists())
-    //{
-    //    bookmarkFile.remove();
-    //    qDebug() << "Successfully removed bookmark file from category:" << categoryName;
-    //}
-
     // 刷新分类页面
     for (int i = 0; i < m_windows.size(); ++i)
     {
@@ -2435,5 +2995,6 @@ void MainWindow::updateReadTime()
         currentBook.totalReadTime = currentBook.totalReadTime.addSecs(zReadSec);
     }
 
-    refreshBookLists();
+    zLibraryModel->bookChanged(zCurrentBookFikePath);//只刷新这一本书
+    saveReadingRecord(zCurrentBookFikePath);//阅读时间和位置一起记入日志，崩溃时最多丢一分钟
 }
\ No newline at end of file
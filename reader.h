@@ -6,6 +6,8 @@
 #include <QMap>
 #include <QString>
 #include <QTime>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QDateTime>
 #include <QFile> 
 #include <QFileInfo>
@@ -13,6 +15,14 @@
 #include <QMenu>
 #include <QInputDialog>
 #include "readerform.h"
+#include "chapterdocument.h"
+#include "bookpaginator.h"
+#include "booksearcher.h"
+#include "fulltextindex.h"
+#include "bookinfo.h"
+#include "librarymodel.h"
+#include "librarystore.h"
+#include "bookidentity.h"
 #include <QTextDocument>
 #include <QVariant>
 #include <QTextStream>
@@ -34,34 +44,6 @@ enum WindowType {
     BOOK_READER     // 书籍阅读器
 };
 
-/*-------------------*/
-//书签
-struct bookMark
-{
-    QString chapterId;//章节id
-    QString chapterTitle;//章节名称
-    int pageInChapter;//章节内页码
-};
-/*-------------------*/
-
-// 表示电子书的数据结构
-struct BookInfo {
-    QString filePath;        // 文件路径
-    QString title;           // 书籍标题
-    QTime totalReadTime;     // 总阅读时间
-    bool isFavorite;         // 是否是收藏
-    QDateTime lastReadTime;  // 最后阅读时间
-    QList<QString> categories; // 所属分类
-    //QMap<int, QString> bookmarks; // 书签列表，键为页码，值为书签描述
-    QList<bookMark> BookMarks;//书签列表，包含id和页码
-    
-    bookMark lastReadRecord;
-
-    BookInfo() : isFavorite(false) {
-        totalReadTime = QTime(0, 0);
-    }
-};
-
 // 分类信息
 struct CategoryInfo {
     QString name;            // 分类名称
@@ -94,6 +76,7 @@ private slots:
     
     // 按钮相关
     void on_addBookButton_clicked();
+    void on_importFolderButton_clicked();
     void on_sortByNameButton_clicked();
     void on_sortByTimeButton_clicked();
     void on_sortByRecentButton_clicked();
@@ -106,7 +89,7 @@ private slots:
     void on_categorySearchButton_clicked();
     
     // 列表项操作
-    void on_allBooksListWidget_itemDoubleClicked(QListWidgetItem *item);
+    void on_allBooksListWidget_doubleClicked(const QModelIndex &index);
     void on_categoriesListWidget_itemDoubleClicked(QListWidgetItem *item);
     void on_favPageListWidget_itemDoubleClicked(QListWidgetItem *item);
     void on_categoryListWidget_itemDoubleClicked(QListWidgetItem *item);
@@ -118,6 +101,7 @@ private slots:
     
     // 搜索功能
     void on_searchLineEdit_textChanged(const QString &text);
+    void on_searchLineEdit_returnPressed();//在全部书籍的正文中搜索
     void on_favSearchLineEdit_textChanged(const QString &text);
     void on_categorySearchLineEdit_textChanged(const QString &text);
 
@@ -130,11 +114,22 @@ private slots:
 
     void on_bookmarkComboBox_currentIndexChanged(int index);
 
+    void on_bookSearchLineEdit_returnPressed();//开始书内搜索
+    void on_searchResultComboBox_currentIndexChanged(int index);//跳转到搜索结果
+    void onBookSearchHit(const bookSearchHit& hit);//收到一条搜索结果
+    void onBookSearchProgress(int searchedChapters, int totalChapters);
+    void onBookSearchFinished(int hitCount);
+
     void gotoPreviousChapter();
     void gotoNextChapter();
 
     void updateReadTime();//更新阅读时间
 
+    void onEpubOpenProgress(int percent);//后台打开进度
+    void onEpubOpenFinished(bool success);//后台打开完成
+    void onChapterPaginated(int chapterIndex, int pageCount);//后台分页完成一章
+    void onLayoutSlice();//空闲时继续排版当前章节
+
 private:
     Ui::MainWindow *ui;
 
@@ -143,9 +138,49 @@ private:
     
     QString zCurrentBookFikePath;//当前打开书的路径
 
+    QString zOpeningBookPath;//正在后台打开的书的路径
+
     QString zCurrentChapterId;//当前章节的id
 
-    QTextDocument* zChapterDocument;//文档对象
+    QByteArray zCurrentChapterHash;//当前章节内容的哈希，用于查询分页缓存
+
+    chapterDocument* zChapterDocument;//文档对象
+
+    bookPaginator* zBookPaginator;//全书分页
+
+    bookSearcher* zBookSearcher;//书内搜索
+
+    fullTextIndex* zFullTextIndex;//书库全文索引
+
+    QString zPendingChapterId;//打开书籍后要跳转的章节，来自全文搜索
+    QString zPendingSearchText;//打开书籍后要在书内搜索的文字
+
+    // 导入时在后台从每本书取出的标识和opf信息
+    struct importedBook
+    {
+        QString filePath;
+        QString bookId;
+        QString sampledId;//旧格式的标识，书库中还有旧格式的记录时才计算
+        QString title;
+        QStringList authors;
+        QStringList subjects;
+        QString thumbnailPath;//封面缩略图，没有封面时为空
+    };
+    // 一次导入的进度，结果按批写入书库
+    struct importProgress
+    {
+        QList<importedBook> pending;//已取出、还没写入书库的书
+        QString openPath;//导入完成后要打开的书
+        QString openTarget;//openPath在书库中的路径，重复的书指向已有的那本
+        int total = 0;
+        int done = 0;
+        int added = 0;
+        int duplicates = 0;
+        int relocated = 0;
+        QElapsedTimer timer;
+    };
+    QFutureWatcher<importedBook>* zImportWatcher;//当前的导入任务
+    importProgress zImport;
 
     QList<QString> zCurrentBookSpineId;//章节id列表
 
@@ -156,6 +191,25 @@ private:
     int zTotalPage;//总页数
     bool zIsScorll;//防止滑动和滚动递归触发
 
+    QTimer* zLayoutTimer;//分段排版当前章节
+    int zLayoutBlock;//下一个待排版的块号，-1表示已排完
+    bool zTotalPageKnown;//总页数来自缓存或已排完，不再随排版增加
+
+    //排版到y坐标或用完时间片(毫秒，负数为不限)为止，返回是否已全部排完
+    bool layoutChapterUntil(qreal y, int budgetMs);
+    //停止分段排版
+    void stopIncrementalLayout();
+
+    //跳转到某章的某页
+    void jumpToChapterPage(const QString& chapterId, int pageInChapter);
+    //清空书内搜索结果
+    void resetBookSearch();
+
+    //全书页码表是否可用于当前章节
+    bool isBookPaging() const;
+    //按章节页码或全书页码更新滑块和页码显示
+    void updatePageIndicator();
+
     QTimer* zTimer;//计时器用来计算阅读时间
 
     // 保存阅读记录
@@ -164,8 +218,8 @@ private:
     void loadReadingRecord(BookInfo& book,const QString& filePath); 
     // 保存书签信息
     void saveBookmarkInfo(const QString& filePath);
-    // 确保书籍有分类，如果没有则创建"未分类"分类
-    void ensureBookHasCategory(const QString& filePath);
+    // 确保书籍有分类，如果没有则创建"未分类"分类，返回是否加入了"未分类"
+    bool ensureBookHasCategory(const QString& filePath);
 
     // 阅读记录文件路径
     QString recordFilePath;
@@ -174,6 +228,38 @@ private:
 
     // 存储所有电子书信息
     QMap<QString, BookInfo> allBooks;
+
+    // 书库的持久化存储，书籍、分类、书签和阅读记录都保存在这里
+    libraryStore zLibraryStore;
+    // 把一本书的当前信息写入书库存储
+    void storeBook(const QString& filePath);
+    // 从书库存储读出一本书的书签和阅读记录，启动时只读了基本信息
+    void ensureBookDetail(const QString& filePath);
+    // 把一个分类的当前书籍列表写入书库存储
+    void storeCategory(const QString& categoryName);
+    // 书籍标识->路径，用于发现重复导入的书和被移动的文件
+    QHash<QString, QString> zBookPathById;
+    // 书库中是否还有以旧格式标识保存的书
+    bool zHasSampledIds;
+    // 根据allBooks重建zBookPathById
+    void indexBookIds();
+    // 在线程池中逐本取出标识和opf信息后导入书籍，openPath非空时导入完成后打开它
+    void importBooks(const QStringList& filePaths, const QString& openPath);
+    // 在后台列出文件夹及子文件夹中的epub，然后导入
+    void importFolder(const QString& folderPath);
+    // 打开一本书取出标识、书名、作者和封面，在工作线程中调用，每个任务用自己的解析器
+    static importedBook identifyBook(const QString& filePath, bool withSampled);
+    // 把已取出的一批书写入书库，整批只追加一次日志
+    void commitImportBatch();
+    // 导入一本已取出信息的书，新书加入newBooks，返回这本书在书库中的路径
+    QString importBook(const importedBook& imported, QList<BookInfo>& newBooks);
+    // 书籍文件被移动后，把书库中的记录改到新路径
+    void relocateBook(const QString& oldPath, const QString& newPath);
+    // 从构造开始计时，书库列表第一次绘制时记录启动用时
+    QElapsedTimer zStartupTimer;
+
+    // 全部书籍列表的模型，负责排序和搜索
+    libraryModel* zLibraryModel;
     
     // 存储分类信息
     QMap<QString, CategoryInfo> m_categories;
@@ -259,15 +345,14 @@ private:
     void updateBookmarkComboBox();
 
     void saveApplicationState();//保存应用进度
-    void loadAllBookData();//加载所有书籍的信息
+    void loadAllBookData();//从分类目录加载所有书籍的书签和阅读记录(旧格式)
     void loadBookMarkFile(BookInfo& book, const QString& filePath);//加载书签
     //bool helpLoadLastReadRecord(BookInfo& book, const QString& filePath);//辅助保存
 
     /*---------------*/
     void loadApplicationState();//加载应用进度
-    void saveBookResigtry(QSettings& setting);//保存书籍注册表
+    void migrateLegacyState();//从旧的注册表和分类目录下的记录文件迁移到书库存储
     void loadBookResigtry(QSettings& seeting);//加载书籍注册表
-    void saveCategoryState(QSettings& setting);//保存分类状态
     void loadCategotyState(QSettings& setting);//加载分类状态
     /*---------------*/
 
@@ -1,16 +1,105 @@
 #include "readerform.h"
+#include "epubmetadatacache.h"
+#include <QCryptographicHash>
+#include <QThreadPool>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrentRun>
+#include <limits>
+
+namespace
+{
+	//按解压后的大小一次分配再读满，避免readAll逐块扩容时的反复复制
+	QByteArray readWholeEntry(QuaZipFile& fileEntry)
+	{
+		const qint64 expected = fileEntry.size();
+		if (expected <= 0 || expected > std::numeric_limits<int>::max())
+		{
+			return fileEntry.readAll();
+		}
+
+		QByteArray data(qsizetype(expected), Qt::Uninitialized);
+		qint64 total = 0;
+		while (total < expected)
+		{
+			const qint64 readBytes = fileEntry.read(data.data() + total, expected - total);
+			if (readBytes <= 0)
+			{
+				break;
+			}
+			total += readBytes;
+		}
+		data.truncate(qsizetype(total));
+		return data;
+	}
+
+	//opf metadata中读取的dc元素
+	enum dcElementKind
+	{
+		DC_OTHER,
+		DC_TITLE,
+		DC_CREATOR,
+		DC_CONTRIBUTOR,
+		DC_IDENTIFIER,
+		DC_LANGUAGE,
+		DC_SUBJECT,
+		DC_DESCRIPTION,
+		DC_PUBLISHER,
+		DC_DATE,
+		DC_RIGHTS,
+		DC_SOURCE,
+		DC_RELATION,
+		DC_COVERAGE,
+		DC_TYPE,
+		DC_FORMAT
+	};
+
+	//按本地名分派，不为元素名构造QString
+	dcElementKind dcElementKindOf(QStringView name)
+	{
+		static const struct
+		{
+			QLatin1String name;
+			dcElementKind kind;
+		} kinds[] = {
+			{ QLatin1String("title"), DC_TITLE },
+			{ QLatin1String("creator"), DC_CREATOR },
+			{ QLatin1String("contributor"), DC_CONTRIBUTOR },
+			{ QLatin1String("identifier"), DC_IDENTIFIER },
+			{ QLatin1String("language"), DC_LANGUAGE },
+			{ QLatin1String("subject"), DC_SUBJECT },
+			{ QLatin1String("description"), DC_DESCRIPTION },
+			{ QLatin1String("publisher"), DC_PUBLISHER },
+			{ QLatin1String("date"), DC_DATE },
+			{ QLatin1String("rights"), DC_RIGHTS },
+			{ QLatin1String("source"), DC_SOURCE },
+			{ QLatin1String("relation"), DC_RELATION },
+			{ QLatin1String("coverage"), DC_COVERAGE },
+			{ QLatin1String("type"), DC_TYPE },
+			{ QLatin1String("format"), DC_FORMAT },
+		};
+		for (const auto& entry : kinds)
+		{
+			if (name == entry.name)
+			{
+				return entry.kind;
+			}
+		}
+		return DC_OTHER;
+	}
+}
 
 readerform::readerform(QObject *parent)
-	: QObject(parent) ,zEpubFile(nullptr)
+	: QObject(parent) ,zEpubFile(nullptr) ,zContentCache(std::make_shared<epubContentCache>()) ,zOpenWatcher(nullptr)
 {}
 
 readerform::~readerform()
 {
+	cancelOpen();
 	closeEpub();
 }
 
 
-QString readerform::normalHref(const QString& opfBase, const QString& relHref) const
+QString readerform::normalHref(const QString& opfBase, const QString& relHref)
 {
 	QString pathOnly = relHref;
 	int anchorPos = pathOnly.indexOf('#');
@@ -47,6 +136,7 @@ void readerform::closeEpub()
 		delete zEpubFile;
 		zEpubFile = nullptr;
 	}
+	zMappedArchive.reset();//后台线程的快照仍持有映射时，由最后一个持有者解除映射
 	//将与当前epub相关的全部请空
 	zManifestItem.clear();
 	zSpineItem.clear();
@@ -56,35 +146,252 @@ void readerform::closeEpub()
 	zEpubFilePath.clear();
 	zLastError.clear();
 	zNcxItemId.clear();
-	zNcxHrefToTitle.clear();
+	zTocEntries.clear();
+	zTableOfContents.reset();
+	zManifestPathByHref.clear();
+	zEntryIndex.clear();
+	zEntryIndexFolded.clear();
+
+	{
+		QMutexLocker locker(&zContentCache->mutex);//作废缓存和还在进行的预读
+		++zContentCache->generation;
+		zContentCache->pending.clear();
+		zContentCache->chapters.clear();
+		zContentCache->hits = 0;
+		zContentCache->misses = 0;
+	}
+}
+
+bool readerform::openEpub(const QString& filePath, epubArchiveBackend backend)
+{
+	return openEpubStaged(filePath, backend, nullptr);
+}
+
+QFuture<bool> readerform::openEpubAsync(const QString& filePath, epubArchiveBackend backend)
+{
+	cancelOpen();//同时只保留最新的打开请求
+
+	//在独立的解析器上解析，成功后再整体交换，避免半成品状态被界面线程看到
+	std::shared_ptr<readerform> staging(new readerform(nullptr), [](readerform* parser) {
+		parser->deleteLater();
+		});
+
+	QFuture<bool> future = QtConcurrent::run([staging, filePath, backend](QPromise<bool>& promise) {
+		promise.setProgressRange(0, 100);
+		promise.addResult(staging->openEpubStaged(filePath, backend, &promise));
+		});
+
+	QFutureWatcher<bool>* watcher = new QFutureWatcher<bool>(this);
+	connect(watcher, &QFutureWatcherBase::progressValueChanged, this, &readerform::openProgress);
+	connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, staging]() {
+		watcher->deleteLater();
+		if (watcher != zOpenWatcher)//已被取消或被新的请求取代
+		{
+			return;
+		}
+		zOpenWatcher = nullptr;
+
+		QFuture<bool> result = watcher->future();
+		bool success = !result.isCanceled() && result.resultCount() > 0 && result.result();
+		if (success)
+		{
+			closeEpub();
+			adoptState(*staging);
+		}
+		else
+		{
+			zLastError = staging->getLastError();
+		}
+		emit openFinished(success);
+		});
+
+	zOpenWatcher = watcher;
+	watcher->setFuture(future);
+	return future;
+}
+
+void readerform::cancelOpen()
+{
+	if (zOpenWatcher)
+	{
+		zOpenWatcher->cancel();//工作线程在下一个阶段检查到取消后退出
+		zOpenWatcher = nullptr;
+	}
+}
+
+bool readerform::isOpening() const
+{
+	return zOpenWatcher != nullptr;
+}
+
+void readerform::adoptState(readerform& other)
+{
+	std::swap(zEpubFile, other.zEpubFile);
+	std::swap(zMappedArchive, other.zMappedArchive);
+	std::swap(zEpubFilePath, other.zEpubFilePath);
+	std::swap(zOpfFilePath, other.zOpfFilePath);
+	std::swap(zOpfbasePath, other.zOpfbasePath);
+	std::swap(zManifestItem, other.zManifestItem);
+	std::swap(zSpineItem, other.zSpineItem);
+	std::swap(zNcxItemId, other.zNcxItemId);
+	std::swap(zTocEntries, other.zTocEntries);
+	std::swap(zTableOfContents, other.zTableOfContents);
+	std::swap(zEntryIndex, other.zEntryIndex);
+	std::swap(zEntryIndexFolded, other.zEntryIndexFolded);
+	std::swap(zMetadata, other.zMetadata);
+	std::swap(zLastError, other.zLastError);
+}
+
+QString readerform::resolveOpfHref(const QString& href)
+{
+	const QString pathOnly = href.left(href.indexOf('#'));//去除锚点，没有锚点时为整个href
+	auto it = zManifestPathByHref.constFind(pathOnly);
+	if (it != zManifestPathByHref.constEnd())
+	{
+		return it.value();
+	}
+	const QString path = normalHref(zOpfbasePath, pathOnly);
+	zManifestPathByHref.insert(pathOnly, path);
+	return path;
 }
 
-bool readerform::openEpub(const QString& filePath)
+QByteArray readerform::centralDirectoryHash() const
+{
+	if (zMappedArchive)
+	{
+		return QCryptographicHash::hash(zMappedArchive->centralDirectory(), QCryptographicHash::Md5);
+	}
+	epubMappedArchive archive;//QuaZip不提供中央目录的原始字节，临时映射一次，只读末尾的中央目录
+	if (!archive.open(zEpubFilePath))
+	{
+		return QByteArray();
+	}
+	return QCryptographicHash::hash(archive.centralDirectory(), QCryptographicHash::Md5);
+}
+
+epubMetadataSnapshot readerform::metadataSnapshot() const
+{
+	epubMetadataSnapshot snapshot;
+	snapshot.opfFilePath = zOpfFilePath;
+	snapshot.opfBasePath = zOpfbasePath;
+	snapshot.manifestItem = zManifestItem;
+	snapshot.spineItem = zSpineItem;
+	snapshot.ncxItemId = zNcxItemId;
+	snapshot.tocEntries = zTocEntries;
+	snapshot.metadata = zMetadata;
+	return snapshot;
+}
+
+void readerform::restoreMetadata(epubMetadataSnapshot& snapshot)
+{
+	zOpfFilePath = std::move(snapshot.opfFilePath);
+	zOpfbasePath = std::move(snapshot.opfBasePath);
+	zManifestItem = std::move(snapshot.manifestItem);
+	zSpineItem = std::move(snapshot.spineItem);
+	zNcxItemId = std::move(snapshot.ncxItemId);
+	zTocEntries = std::move(snapshot.tocEntries);
+	zMetadata = std::move(snapshot.metadata);
+}
+
+bool readerform::isArchiveOpen() const
+{
+	return zMappedArchive || (zEpubFile && zEpubFile->isOpen());
+}
+
+bool readerform::openEpubStaged(const QString& filePath, epubArchiveBackend backend, QPromise<bool>* promise)
 {
 	closeEpub();//先关闭防止出错
 
-	zEpubFile = new QuaZip(filePath);
+	auto reportProgress = [promise](int percent) {
+		if (promise)
+		{
+			promise->setProgressValue(percent);
+		}
+		};
+	auto isCanceled = [this, promise]() {
+		if (promise && promise->isCanceled())
+		{
+			zLastError = tr("opening was canceled");
+			return true;
+		}
+		return false;
+		};
+
 	zEpubFilePath = filePath;
 
-	if (!zEpubFile->open(QuaZip::mdUnzip))
+	if (backend == MAPPED_ARCHIVE)
+	{
+		std::shared_ptr<epubMappedArchive> mappedArchive = std::make_shared<epubMappedArchive>();
+		if (mappedArchive->open(filePath))
+		{
+			zMappedArchive = mappedArchive;
+		}
+		else//映射失败时退回QuaZip
+		{
+			qWarning() << "Failed to map epub file, fall back to QuaZip:" << mappedArchive->getLastError();
+		}
+	}
+
+	if (!zMappedArchive)
+	{
+		zEpubFile = new QuaZip(filePath);
+
+		if (!zEpubFile->open(QuaZip::mdUnzip))
+		{
+			zLastError = tr("Failed to open Epub File %1, error: % 2").arg(filePath).arg(zEpubFile->getZipError());// 打开失败保存错误信息
+			qWarning() << zLastError;
+			delete zEpubFile;
+			zEpubFile = nullptr;
+			return false;
+		}
+	}
+
+	reportProgress(10);
+	if (isCanceled())
 	{
-		zLastError = tr("Failed to open Epub File %1, error: % 2").arg(filePath).arg(zEpubFile->getZipError());// 打开失败保存错误信息
-		qWarning() << zLastError;
-		delete zEpubFile;
-		zEpubFile = nullptr;
 		return false;
 	}
+
+	buildEntryIndex();//只扫描一次中央目录，之后的查找都走索引
+	reportProgress(30);
+	if (isCanceled())
+	{
+		return false;
+	}
+
+	//书籍没有改动时直接用上次的解析结果，不再解析container.xml、opf和ncx
+	const QByteArray centralDirHash = centralDirectoryHash();
+	epubMetadataSnapshot cached;
+	if (epubMetadataCache::load(filePath, centralDirHash, cached))
+	{
+		restoreMetadata(cached);
+		zTableOfContents = std::make_shared<const epubTableOfContents>(zTocEntries, zSpineItem, zManifestItem);
+		reportProgress(100);
+		zLastError.clear();
+		return true;
+	}
 		
 	if (!parseContainerXml())
 	{
 		return false;
 	}
+	reportProgress(40);
+	if (isCanceled())
+	{
+		return false;
+	}
 
 	if (!parseOpfFile())
 	{
 		return false;
 	}
+	reportProgress(80);
+	if (isCanceled())
+	{
+		return false;
+	}
 
+	bool tocComplete = true;//目录解析出错时不缓存，下次打开重新解析
 
 	//解析ncx
 	if (!zNcxItemId.isEmpty())
@@ -92,7 +399,7 @@ bool readerform::openEpub(const QString& filePath)
 		if (zManifestItem.contains(zNcxItemId))
 		{
 			const epubManifestItem& ncxItem = zManifestItem.value(zNcxItemId);
-			QString  ncxFilePathInZip = normalHref(zOpfbasePath, ncxItem.href);
+			const QString& ncxFilePathInZip = ncxItem.path;
 
 			qDebug() << "NCX file found in manifest via spine toc id" << zNcxItemId << ":" << ncxItem.href << "-> Full path in zip :" << ncxFilePathInZip;
 
@@ -100,6 +407,7 @@ bool readerform::openEpub(const QString& filePath)
 			{
 				qWarning() << "Failed to parse ncx File , table of content will use fallback" << getLastError();
 				zLastError.clear();
+				tocComplete = false;
 			}
 		}
 		else
@@ -109,55 +417,51 @@ bool readerform::openEpub(const QString& filePath)
 	}
 	else
 	{
-		qWarning() << "no NCX item ID";
+		qDebug() << "no NCX item ID";
 	}
 
-	zLastError.clear();//打开成功，清除错误信息
-	return true;
-}
-
-QMap<QString, QString> readerform::getTableofContent() const
-{
-	QMap<QString, QString> tocDisplayMap;
-	for (const SpineItem& spineItem : std::as_const(zSpineItem))
+	//epub3没有ncx(或ncx为空)时，用manifest中properties含nav的导航文档
+	if (zTocEntries.isEmpty())
 	{
-		if (!spineItem.linear)
+		for (const epubManifestItem& item : std::as_const(zManifestItem))
 		{
-			continue;
-		}
-
-		if (zManifestItem.contains(spineItem.idref))
-		{
-			const epubManifestItem& manifestItem = zManifestItem.value(spineItem.idref);
-			QString manifestHref = manifestItem.href;
-			QString normalManifestHref = normalHref(zOpfbasePath, manifestHref);
-
-			QString displayString;
-			qDebug() << normalManifestHref;
-			if (zNcxHrefToTitle.contains(normalManifestHref))
-			{
-				displayString = zNcxHrefToTitle.value(normalManifestHref);
-				qDebug() << tr("yes");
-			}
-			else//如果没有此条目，则使用文件名
+			if (item.properties.split(' ', Qt::SkipEmptyParts).contains("nav"))
 			{
-				QFileInfo fileInfo(manifestHref);
-				displayString = fileInfo.fileName();
-				if (displayString.isEmpty())//没有文件名，则使用id
+				if (!parseNavDocument(item.path))
 				{
-					displayString = manifestItem.id;
+					qWarning() << "Failed to parse navigation document, table of content will use fallback" << getLastError();
+					zLastError.clear();
+					tocComplete = false;
 				}
-				qDebug() << tr("no");
+				break;
 			}
-			tocDisplayMap.insert(spineItem.idref, displayString);
-		}
-		else
-		{
-			qWarning() << "Spine item idref " << spineItem.idref << " not found in manifest.";
-			tocDisplayMap.insert(spineItem.idref, spineItem.idref + " not found.");
 		}
 	}
-	return tocDisplayMap;
+
+	zManifestPathByHref.clear();//解析结束，路径已保存在manifest中
+	if (tocComplete)
+	{
+		epubMetadataCache::save(filePath, centralDirHash, metadataSnapshot());
+	}
+	zTableOfContents = std::make_shared<const epubTableOfContents>(zTocEntries, zSpineItem, zManifestItem);
+	reportProgress(100);
+	zLastError.clear();//打开成功，清除错误信息
+	return true;
+}
+
+QMap<QString, QString> readerform::getTableofContent() const
+{
+	return getTableOfContents()->chapterTitles();//共享数据，不复制
+}
+
+std::shared_ptr<const epubTableOfContents> readerform::getTableOfContents() const
+{
+	if (!zTableOfContents)
+	{
+		static const std::shared_ptr<const epubTableOfContents> empty = std::make_shared<const epubTableOfContents>();
+		return empty;
+	}
+	return zTableOfContents;
 }
 
 QString readerform::getContentById(const QString& itemId)
@@ -169,48 +473,66 @@ QString readerform::getContentById(const QString& itemId)
 		return QString();
 	}
 
-	const epubManifestItem& item = zManifestItem.value(itemId);//id转化为item
-	QString filePathInZip = zOpfbasePath + item.href;
-
-	//规范路径
-	QUrl opfBaseUrl = QUrl::fromLocalFile(zOpfbasePath.isEmpty() ? "/" : "/" + zOpfbasePath);
+	{
+		QMutexLocker locker(&zContentCache->mutex);//缓存命中则不再解压
+		if (const QString* cached = zContentCache->chapters.object(itemId))
+		{
+			++zContentCache->hits;
+			return *cached;
+		}
+		++zContentCache->misses;
+	}
 
-	if (!zOpfbasePath.endsWith('/') && !zOpfbasePath.isEmpty()) 
-		opfBaseUrl = QUrl::fromLocalFile("/" + zOpfbasePath + "/");
+	const QString filePathInZip = getContentPathById(itemId);
+	QString content = QString::fromUtf8(readBinaryFileContentFromZip(filePathInZip));
+	if (!content.isEmpty())
+	{
+		QMutexLocker locker(&zContentCache->mutex);
+		zContentCache->chapters.insert(itemId, new QString(content), content.size() * qsizetype(sizeof(QChar)));
+	}
+	return content;
+}
 
-	QUrl resolvedUrl = opfBaseUrl.resolved(item.href);
-	filePathInZip = resolvedUrl.path();
-	if (filePathInZip.startsWith("/"))
+QString readerform::getContentPathById(const QString& itemId) const
+{
+	auto it = zManifestItem.constFind(itemId);
+	if (it == zManifestItem.constEnd())
 	{
-		filePathInZip = filePathInZip.mid(1);
+		return QString();
 	}
+	return it->path;
+}
 
+QByteArray readerform::getResourceByPath(const QString& filePathInZip)
+{
 	return readBinaryFileContentFromZip(filePathInZip);
 }
 
 QString readerform::getCoverImagePath() const
 {
-	if (!zMetadata.contains("cover"))//检查是否有cover
+	QString coverId = zMetadata.value("cover_ref_id").toString();//epub2：<meta name="cover" content="id"/>
+	if (!zManifestItem.contains(coverId))
 	{
-		QString coverId = zMetadata.value("cover").toString();//转化成id
-		if (zManifestItem.contains(coverId))
+		coverId.clear();
+		for (auto it = zManifestItem.cbegin(); it != zManifestItem.cend(); ++it)//epub3：manifest中properties含cover-image的项
 		{
-			const epubManifestItem& item = zManifestItem.value(coverId);//转化为item
-			if (item.mediaType.startsWith("image/"))//检查路径,并规范路径，需要相对于opf基路径
+			if (it.value().properties.split(' ', Qt::SkipEmptyParts).contains("cover-image"))
 			{
-				QUrl opfBaseUrl = QUrl::fromLocalFile(zOpfbasePath.isEmpty() ? "/" : "/" + zOpfbasePath);
-				if (!zOpfbasePath.endsWith('/') && !zOpfbasePath.isEmpty())
-					opfBaseUrl = QUrl::fromLocalFile("/" + zOpfbasePath + "/");
-				QUrl resolvedUrl = opfBaseUrl.resolved(item.href);
-				QString fileInZip = resolvedUrl.path();
-				if (fileInZip.startsWith("/"))
-				{
-					fileInZip = fileInZip.mid(1);
-				}
-				return fileInZip;
+				coverId = it.key();
+				break;
 			}
 		}
 	}
+
+	if (zManifestItem.contains(coverId))
+	{
+		const epubManifestItem& item = zManifestItem.value(coverId);//转化为item
+		if (item.mediaType.startsWith("image/"))//检查路径,并规范路径，需要相对于opf基路径
+		{
+			return item.path;
+		}
+	}
+	return QString();//没有封面
 }
 
 QVariantMap readerform::getMetaDate() const
@@ -218,6 +540,28 @@ QVariantMap readerform::getMetaDate() const
 	return zMetadata;
 }
 
+QString readerform::uniqueIdentifier() const
+{
+	const QString uniqueId = zMetadata.value("unique_identifier_id").toString();
+	const QList<QVariantMap> identifiers = zMetadata.value("identifiers").value<QList<QVariantMap>>();
+	if (!uniqueId.isEmpty())
+	{
+		for (const QVariantMap& identifier : identifiers)
+		{
+			if (identifier.value("id").toString() == uniqueId)
+			{
+				return identifier.value("value").toString();
+			}
+		}
+	}
+	return identifiers.isEmpty() ? QString() : identifiers.first().value("value").toString();
+}
+
+QByteArray readerform::centralDirectory() const
+{
+	return zMappedArchive ? zMappedArchive->centralDirectory() : QByteArray();
+}
+
 QString readerform::getLastError() const
 {
 	return zLastError;
@@ -233,9 +577,156 @@ QString readerform::getNcxItemId() const
 	return zNcxItemId;
 }
 
+epubReadSnapshot readerform::readSnapshot() const
+{
+	epubReadSnapshot snapshot;
+	snapshot.epubFilePath = zEpubFilePath;
+	snapshot.opfBasePath = zOpfbasePath;
+	snapshot.manifestItem = zManifestItem;
+	snapshot.entryIndex = zEntryIndex;
+	snapshot.entryIndexFolded = zEntryIndexFolded;
+	snapshot.mappedArchive = zMappedArchive;
+	return snapshot;
+}
+
+void readerform::prefetchContent(const QStringList& itemIds)
+{
+	if (!isArchiveOpen())
+	{
+		return;
+	}
+
+	QStringList toLoad;
+	quint64 generation = 0;
+	{
+		QMutexLocker locker(&zContentCache->mutex);
+		generation = zContentCache->generation;
+		for (const QString& itemId : itemIds)
+		{
+			if (zManifestItem.contains(itemId) && !zContentCache->chapters.contains(itemId) && !zContentCache->pending.contains(itemId))
+			{
+				zContentCache->pending.insert(itemId);
+				toLoad.append(itemId);
+			}
+		}
+	}
+
+	if (toLoad.isEmpty())
+	{
+		return;
+	}
+
+	std::shared_ptr<epubContentCache> cache = zContentCache;
+	epubReadSnapshot snapshot = readSnapshot();
+	QThreadPool::globalInstance()->start([cache, snapshot, toLoad, generation]() {
+		epubEntryReader reader(snapshot);
+		for (const QString& itemId : toLoad)
+		{
+			QString content = QString::fromUtf8(reader.readContentById(itemId));
+
+			QMutexLocker locker(&cache->mutex);
+			if (cache->generation != generation)//书籍已关闭或切换
+			{
+				return;
+			}
+			cache->pending.remove(itemId);
+			if (!content.isEmpty())
+			{
+				cache->chapters.insert(itemId, new QString(content), content.size() * qsizetype(sizeof(QChar)));
+			}
+		}
+		});
+}
+
+void readerform::setContentCacheBudget(qsizetype bytes)
+{
+	QMutexLocker locker(&zContentCache->mutex);
+	zContentCache->chapters.setMaxCost(bytes);//超出上限时QCache会按最近最少使用淘汰
+}
+
+epubCacheStats readerform::getContentCacheStats() const
+{
+	QMutexLocker locker(&zContentCache->mutex);
+	epubCacheStats stats;
+	stats.hits = zContentCache->hits;
+	stats.misses = zContentCache->misses;
+	stats.usedBytes = zContentCache->chapters.totalCost();
+	stats.budgetBytes = zContentCache->chapters.maxCost();
+	return stats;
+}
+
+epubEntryReader::epubEntryReader(const epubReadSnapshot& snapshot)
+	: zSnapshot(snapshot), zZip(nullptr)
+{}
+
+epubEntryReader::~epubEntryReader()
+{
+	if (zZip)
+	{
+		zZip->close();
+		delete zZip;
+	}
+}
+
+QByteArray epubEntryReader::read(const QString& filePathInZip)
+{
+	if (zSnapshot.mappedArchive)//映射区域只读，可以直接在工作线程中访问
+	{
+		return zSnapshot.mappedArchive->read(filePathInZip);
+	}
+
+	if (!zZip)//第一次读取时才打开
+	{
+		zZip = new QuaZip(zSnapshot.epubFilePath);
+		if (!zZip->open(QuaZip::mdUnzip))
+		{
+			qWarning() << "epubEntryReader could not open" << zSnapshot.epubFilePath << zZip->getZipError();
+			delete zZip;
+			zZip = nullptr;
+			return QByteArray();
+		}
+	}
+
+	auto it = zSnapshot.entryIndex.constFind(filePathInZip);
+	if (it == zSnapshot.entryIndex.constEnd())
+	{
+		it = zSnapshot.entryIndexFolded.constFind(filePathInZip.toCaseFolded());
+		if (it == zSnapshot.entryIndexFolded.constEnd())
+		{
+			return QByteArray();
+		}
+	}
+
+	if (!zZip->setCurrentFilePosition(it.value()))
+	{
+		return QByteArray();
+	}
+
+	QuaZipFile fileEntry(zZip);
+	if (!fileEntry.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "epubEntryReader could not open" << filePathInZip << fileEntry.getZipError();
+		return QByteArray();
+	}
+
+	QByteArray data = readWholeEntry(fileEntry);
+	fileEntry.close();
+	return data;
+}
+
+QByteArray epubEntryReader::readContentById(const QString& itemId)
+{
+	auto it = zSnapshot.manifestItem.constFind(itemId);
+	if (it == zSnapshot.manifestItem.constEnd())
+	{
+		return QByteArray();
+	}
+	return read(it->path);
+}
+
 bool readerform::parseContainerXml()
 {
-	if (!zEpubFile || !zEpubFile->isOpen())//未打开
+	if (!isArchiveOpen())//未打开
 	{
 		zLastError = tr("Epub file not open");
 		qWarning() << zLastError;
@@ -244,23 +735,15 @@ bool readerform::parseContainerXml()
 
 	const QString containerPath = "META-INF/container.xml";//存储路径
 
-	if (!zEpubFile->setCurrentFile(containerPath))//设置失败
+	QByteArray containerData = readBinaryFileContentFromZip(containerPath);
+	if (containerData.isEmpty())//读取失败
 	{
 		zLastError = tr("Epub missing '%1'").arg(containerPath);
 		qWarning() << zLastError;
 		return false;
 	}
 
-	QuaZipFile containerFileStream(zEpubFile);
-	if (!containerFileStream.open(QIODevice::ReadOnly))
-	{
-		zLastError = tr("not open %1，error:%2").arg(containerPath).arg(containerFileStream.getZipError());
-		qWarning() << zLastError;
-		return false;
-	}
-
-	zOpfFilePath = findOpfFilePath(containerFileStream);//获取opf文件路径
-	containerFileStream.close();
+	zOpfFilePath = findOpfFilePath(containerData);//获取opf文件路径
 
 	if (zOpfFilePath.isEmpty())//路径为空
 	{
@@ -288,18 +771,19 @@ bool readerform::parseContainerXml()
 	return true;
 }
 
-QString readerform::findOpfFilePath(QuaZipFile& containerFileStream)
+QString readerform::findOpfFilePath(const QByteArray& containerData)
 {
-	QXmlStreamReader xml(&containerFileStream);//解析epubxml
+	QXmlStreamReader xml(containerData);//解析epubxml
 	while (!xml.atEnd() && !xml.hasError())
 	{
 		xml.readNext();
-		if (xml.isStartElement() && xml.name().toString() == "rootfile")
+		if (xml.isStartElement() && xml.name() == QLatin1String("rootfile"))
 		{
-			QXmlStreamAttributes attributes = xml.attributes();//提取属性
-			if (attributes.hasAttribute("full-path"))
+			const QXmlStreamAttributes attributes = xml.attributes();//提取属性
+			const QStringView fullPath = attributes.value(QLatin1String("full-path"));
+			if (!fullPath.isNull())
 			{
-				return attributes.value("full-path").toString();
+				return fullPath.toString();
 			}
 		}
 	}
@@ -315,51 +799,48 @@ QString readerform::findOpfFilePath(QuaZipFile& containerFileStream)
 
 bool readerform::parseOpfFile()
 {
-	if (!zEpubFile || !zEpubFile->isOpen() || zOpfFilePath.isEmpty())
+	if (!isArchiveOpen() || zOpfFilePath.isEmpty())
 	{
 		zLastError = tr("opf file path is empty or epub is not open");
 		qWarning() << zLastError;
 		return false;
 	}
 
-	if (!zEpubFile->setCurrentFile(zOpfFilePath))//设置路径
+	QByteArray opfData = readBinaryFileContentFromZip(zOpfFilePath);
+	if (opfData.isEmpty())
 	{
-		zLastError = tr("not find opf file：%1，error：%2").arg(zOpfFilePath).arg(zEpubFile->getZipError());
+		zLastError = tr("open opf file failed：%1，error：%2").arg(zOpfFilePath).arg(getLastError());
 		qWarning() << zLastError;
 		return false;
 	}
 
-	QuaZipFile opfContentFile(zEpubFile);//打开epub文件
-	if (!opfContentFile.open(QIODevice::ReadOnly))
-	{
-		zLastError = tr("open opf file failed：%1，error：%2").arg(zOpfFilePath).arg(opfContentFile.getZipError());
-		qWarning() << zLastError;
-		return false;
-	}
-
-	QXmlStreamReader xml(&opfContentFile);//解析xml格式
+	QXmlStreamReader xml(opfData);//解析xml格式
 	while (!xml.atEnd() && !xml.hasError())
 	{
 		xml.readNext();
 		if (xml.isStartElement())
 		{
-			if (xml.name().toString() == "metadata")
+			const QStringView name = xml.name();//各解析函数会读后面的记号，视图只用于分派
+			if (name == QLatin1String("package"))
+			{
+				//书籍唯一标识符所在dc:identifier的id
+				zMetadata["unique_identifier_id"] = xml.attributes().value(QLatin1String("unique-identifier")).toString();
+			}
+			else if (name == QLatin1String("metadata"))
 			{
 				parseOpfMetadata(xml);
 			}
-			if (xml.name().toString() == "manifest")
+			else if (name == QLatin1String("manifest"))
 			{
 				parseManifest(xml);
 			}
-			if (xml.name().toString() == "spine")
+			else if (name == QLatin1String("spine"))
 			{
 				parseSpine(xml);
 			}
 		}
 	}
 
-	opfContentFile.close();
-
 	if (xml.hasError())
 	{
 		zLastError = tr("xml parsing failed in %1：%2").arg(zOpfFilePath).arg(xml.errorString());
@@ -367,14 +848,15 @@ bool readerform::parseOpfFile()
 		return false;
 	}
 
+	return true;
 }
 
 void readerform::parseOpfMetadata(QXmlStreamReader& xml)
 {
-	if (!xml.isStartElement() || xml.name().toString() != "metadata")//防止错误进入
+	if (!xml.isStartElement() || xml.name() != QLatin1String("metadata"))//防止错误进入
 		return;
 
-	const QString dcNamespaceUri = "http://purl.org/dc/elements/1.1/";
+	const QLatin1String dcNamespaceUri("http://purl.org/dc/elements/1.1/");
 
 	// 用于收集可重复的元数据项
 	QList<QVariantMap> creatorsList;
@@ -392,23 +874,23 @@ void readerform::parseOpfMetadata(QXmlStreamReader& xml)
 	// 临时存储父dc元素的ID，以备子<meta>元素通过opf:refines引用
 	// QString currentDCOpjectId; // 如果要支持opf:refines，但这里简化，暂不处理
 
-	while (!(xml.isEndElement() && xml.name().toString() == "metadata") && !xml.atEnd()) 
+	while (!(xml.isEndElement() && xml.name() == QLatin1String("metadata")) && !xml.atEnd()) 
 	{
 		xml.readNext();
 
 		if (xml.isStartElement()) 
 		{
-			QString tagName = xml.name().toString(); // 本地名
-			QString nsUri = xml.namespaceUri().toString(); // 命名空间 URI
+			const QStringView tagName = xml.name(); // 本地名，只在读下一个记号之前使用
+			const QStringView nsUri = xml.namespaceUri(); // 命名空间 URI，只在读下一个记号之前使用
 			QXmlStreamAttributes attributes = xml.attributes();
 
 			// 处理 <meta> 标签 
-			if (tagName == "meta") 
+			if (tagName == QLatin1String("meta")) 
 			{
-				if (attributes.hasAttribute("name") && attributes.value("name") == "cover" && attributes.hasAttribute("content")) 
+				if (attributes.hasAttribute(QLatin1String("name")) && attributes.value(QLatin1String("name")) == QLatin1String("cover") && attributes.hasAttribute(QLatin1String("content"))) 
 				{
 					// EPUB 2 Cover ID (来自 <meta name="cover" content="cover-image-id"/>)
-					zMetadata["cover_ref_id"] = attributes.value("content").toString();
+					zMetadata["cover_ref_id"] = attributes.value(QLatin1String("content")).toString();
 				}
 				
 				if (xml.isStartElement()) // 确保仍然是开始标签，以防万一
@@ -420,11 +902,12 @@ void readerform::parseOpfMetadata(QXmlStreamReader& xml)
 			// 处理dc元素 
 			else if (nsUri == dcNamespaceUri) 
 			{
-				QString elementId = attributes.value("id").toString(); // 获取DC元素的id属性
+				const dcElementKind kind = dcElementKindOf(tagName); // readElementText之后tagName失效，先取出种类
+				QString elementId = attributes.value(QLatin1String("id")).toString(); // 获取DC元素的id属性
 				// 使用 readElementText 获取元素的所有文本内容，并跳过任何子元素
 				QString textContent = xml.readElementText(QXmlStreamReader::SkipChildElements).trimmed();
 
-				if (tagName == "title") 
+				if (kind == DC_TITLE) 
 				{
 					QVariantMap titleMap;
 					titleMap["value"] = textContent;
@@ -436,94 +919,94 @@ void readerform::parseOpfMetadata(QXmlStreamReader& xml)
 					if (!elementId.isEmpty()) 
 						zMetadata["title_id"] = elementId; // 存ID
 				}
-				else if (tagName == "creator") 
+				else if (kind == DC_CREATOR) 
 				{
 					QVariantMap entryMap;
 					entryMap["name"] = textContent;
 					if (!elementId.isEmpty()) 
 						entryMap["id"] = elementId;
-					if (attributes.hasAttribute("role")) 
-						entryMap["role"] = attributes.value("role").toString(); // opf:role
-					if (attributes.hasAttribute("file-as")) 
-						entryMap["file-as"] = attributes.value("file-as").toString(); // opf:file-as
+					if (attributes.hasAttribute(QLatin1String("role"))) 
+						entryMap["role"] = attributes.value(QLatin1String("role")).toString(); // opf:role
+					if (attributes.hasAttribute(QLatin1String("file-as"))) 
+						entryMap["file-as"] = attributes.value(QLatin1String("file-as")).toString(); // opf:file-as
 					creatorsList.append(entryMap);
 				}
-				else if (tagName == "contributor") 
+				else if (kind == DC_CONTRIBUTOR) 
 				{
 					QVariantMap entryMap;
 					entryMap["name"] = textContent;
 					if (!elementId.isEmpty()) 
 						entryMap["id"] = elementId;
-					if (attributes.hasAttribute("role")) 
-						entryMap["role"] = attributes.value("role").toString();
-					if (attributes.hasAttribute("file-as")) 
-						entryMap["file-as"] = attributes.value("file-as").toString();
+					if (attributes.hasAttribute(QLatin1String("role"))) 
+						entryMap["role"] = attributes.value(QLatin1String("role")).toString();
+					if (attributes.hasAttribute(QLatin1String("file-as"))) 
+						entryMap["file-as"] = attributes.value(QLatin1String("file-as")).toString();
 					contributorsList.append(entryMap);
 				}
-				else if (tagName == "identifier") 
+				else if (kind == DC_IDENTIFIER) 
 				{
 					QVariantMap entryMap;
 					entryMap["value"] = textContent;
 					if (!elementId.isEmpty()) 
 						entryMap["id"] = elementId;
 					// opf:scheme 在 EPUB 2 中是可选的，但常见
-					if (attributes.hasAttribute("scheme")) 
-						entryMap["scheme"] = attributes.value("scheme").toString(); // opf:scheme
+					if (attributes.hasAttribute(QLatin1String("scheme"))) 
+						entryMap["scheme"] = attributes.value(QLatin1String("scheme")).toString(); // opf:scheme
 					identifiersList.append(entryMap);
 				}
-				else if (tagName == "language") 
+				else if (kind == DC_LANGUAGE) 
 				{
 					languagesList.append(textContent);
 				}
-				else if (tagName == "subject") 
+				else if (kind == DC_SUBJECT) 
 				{
 					subjectsList.append(textContent);
 				}
-				else if (tagName == "description") 
+				else if (kind == DC_DESCRIPTION) 
 				{
 					// 通常一个主要描述
 					zMetadata["description"] = textContent;
 					if (!elementId.isEmpty()) 
 						zMetadata["description_id"] = elementId;
 				}
-				else if (tagName == "publisher") 
+				else if (kind == DC_PUBLISHER) 
 				{
 					zMetadata["publisher"] = textContent;
 					if (!elementId.isEmpty()) zMetadata["publisher_id"] = elementId;
 				}
-				else if (tagName == "date") 
+				else if (kind == DC_DATE) 
 				{
 					QVariantMap entryMap;
 					entryMap["value"] = textContent;
 					if (!elementId.isEmpty()) 
 						entryMap["id"] = elementId;
-					if (attributes.hasAttribute("event")) 
-						entryMap["event"] = attributes.value("event").toString(); // opf:event
+					if (attributes.hasAttribute(QLatin1String("event"))) 
+						entryMap["event"] = attributes.value(QLatin1String("event")).toString(); // opf:event
 					datesList.append(entryMap);
 				}
-				else if (tagName == "rights") 
+				else if (kind == DC_RIGHTS) 
 				{
 					zMetadata["rights"] = textContent;
 					if (!elementId.isEmpty()) 
 						zMetadata["rights_id"] = elementId;
 				}
-				else if (tagName == "source") 
+				else if (kind == DC_SOURCE) 
 				{
 					sourcesList.append(textContent);
 				}
-				else if (tagName == "relation") 
+				else if (kind == DC_RELATION) 
 				{
 					relationsList.append(textContent);
 				}
-				else if (tagName == "coverage") 
+				else if (kind == DC_COVERAGE) 
 				{
 					coveragesList.append(textContent);
 				}
-				else if (tagName == "type") 
+				else if (kind == DC_TYPE) 
 				{
 					typesList.append(textContent);
 				}
-				else if (tagName == "format") 
+				else if (kind == DC_FORMAT) 
 				{
 					formatsList.append(textContent);
 				}
@@ -565,63 +1048,38 @@ void readerform::parseOpfMetadata(QXmlStreamReader& xml)
 
 void readerform::parseManifest(QXmlStreamReader& xml)
 {
-	if (!xml.isStartElement() || xml.name().toString() != "manifest")//防止无manifest标签
+	if (!xml.isStartElement() || xml.name() != QLatin1String("manifest"))//防止无manifest标签
 	{
 		zLastError = tr("no manifest tag");
 		qWarning() << zLastError;
 		return;
 	}
 
-	while (!(xml.isEndElement() && xml.name().toString() == "manifest") && !xml.atEnd())
+	while (!(xml.isEndElement() && xml.name() == QLatin1String("manifest")) && !xml.atEnd())
 	{
 		xml.readNext();
-		if (xml.isStartElement() && xml.name().toString() == "item")
+		if (xml.isStartElement() && xml.name() == QLatin1String("item"))
 		{
-			QXmlStreamAttributes attributs = xml.attributes();//获取属性
-			epubManifestItem currentItem;
-
-			if (attributs.hasAttribute("id"))
-			{
-				currentItem.id = attributs.value("id").toString();
-			}
-			else
-			{
-				qWarning() << " missing id";
-				xml.skipCurrentElement();//无id跳过元素
-				continue;
-			}
-
-			if (attributs.hasAttribute("href"))
-			{
-				currentItem.href = attributs.value("href").toString();
-			}
-			else
-			{
-				qWarning() << "missing href";
-				xml.skipCurrentElement();//无href跳过元素
-				continue;
-			}
-
-			if (attributs.hasAttribute("media-type"))
-			{
-				currentItem.mediaType = attributs.value("media-type").toString();
-			}
-			else
+			//属性按视图读取，只在存入manifest时转成QString
+			const QXmlStreamAttributes attributes = xml.attributes();
+			const QStringView id = attributes.value(QLatin1String("id"));
+			const QStringView href = attributes.value(QLatin1String("href"));
+			const QStringView mediaType = attributes.value(QLatin1String("media-type"));
+			if (id.isEmpty() || href.isEmpty() || mediaType.isEmpty())//缺少任一属性则跳过元素
 			{
-				qWarning() << "missing media-type";
-				xml.skipCurrentElement();//无media-type跳过元素
+				qWarning() << "manifest item missing id, href or media-type";
+				xml.skipCurrentElement();
 				continue;
 			}
 
-			if (attributs.hasAttribute("fallback"))
-			{
-				currentItem.fallback = attributs.value("fallback").toString();
-			}
-
-			if (!currentItem.id.isEmpty() && !currentItem.href.isEmpty() && !currentItem.mediaType.isEmpty())//都不缺失则插入到目录
-			{
-				zManifestItem.insert(currentItem.id, currentItem);
-			}
+			epubManifestItem currentItem;
+			currentItem.id = id.toString();
+			currentItem.href = href.toString();
+			currentItem.mediaType = mediaType.toString();
+			currentItem.fallback = attributes.value(QLatin1String("fallback")).toString();
+			currentItem.properties = attributes.value(QLatin1String("properties")).toString();
+			currentItem.path = resolveOpfHref(currentItem.href);
+			zManifestItem.insert(currentItem.id, currentItem);
 
 		}
 	}
@@ -633,40 +1091,29 @@ void readerform::parseManifest(QXmlStreamReader& xml)
 
 void readerform::parseSpine(QXmlStreamReader& xml)
 {
-	if (!xml.isStartElement() || xml.name().toString() != "spine")
+	if (!xml.isStartElement() || xml.name() != QLatin1String("spine"))
 	{
 		zLastError = tr("no spine tag");
 		qWarning() << zLastError;
 		return;
 	}
 
-	QXmlStreamAttributes spineAttributes = xml.attributes();//获取spine属性
-
-	if (spineAttributes.hasAttribute("toc"))//提取toc属性
-	{
-		zNcxItemId = spineAttributes.value("toc").toString();
-	}
-	else
+	const QXmlStreamAttributes spineAttributes = xml.attributes();//获取spine属性
+	const QStringView toc = spineAttributes.value(QLatin1String("toc"));
+	if (!toc.isNull())//提取toc属性，epub3通常没有，目录改由导航文档提供
 	{
-		zLastError = tr("no toc attribute");
-		qWarning() << zLastError;
-		return;
+		zNcxItemId = toc.toString();
 	}
 
 	zSpineItem.clear();
-	while (!(xml.isEndElement() && xml.name().toString() == "spine") && !xml.atEnd())
+	while (!(xml.isEndElement() && xml.name() == QLatin1String("spine")) && !xml.atEnd())
 	{
 		xml.readNext();
-		if (xml.isStartElement() && xml.name().toString() == "itemref")
+		if (xml.isStartElement() && xml.name() == QLatin1String("itemref"))
 		{
-			SpineItem currentSpineItem;
-			QXmlStreamAttributes itemrefAttribute = xml.attributes();
-			//提取idref属性
-			if (itemrefAttribute.hasAttribute("idref"))
-			{
-				currentSpineItem.idref = itemrefAttribute.value("idref").toString();
-			}
-			else
+			const QXmlStreamAttributes itemrefAttributes = xml.attributes();
+			const QStringView idref = itemrefAttributes.value(QLatin1String("idref"));
+			if (idref.isEmpty())//提取idref属性
 			{
 				zLastError = tr("no idref attribute");
 				qWarning() << zLastError;
@@ -674,26 +1121,10 @@ void readerform::parseSpine(QXmlStreamReader& xml)
 				continue;
 			}
 
-			if (itemrefAttribute.hasAttribute("linear"))
-			{
-				if (itemrefAttribute.value("linear").toString() == "no")
-				{
-					currentSpineItem.linear = false;
-				}
-				else
-				{
-					currentSpineItem.linear = true;
-				}
-			}
-			else
-			{
-				currentSpineItem.linear = true;
-			}
-			//加入spineItem列表
-			if (!currentSpineItem.idref.isEmpty())
-			{
-				zSpineItem.append(currentSpineItem);
-			}
+			SpineItem currentSpineItem;
+			currentSpineItem.idref = idref.toString();
+			currentSpineItem.linear = itemrefAttributes.value(QLatin1String("linear")) != QLatin1String("no");
+			zSpineItem.append(currentSpineItem);//加入spineItem列表
 		}
 
 	}
@@ -705,55 +1136,82 @@ void readerform::parseSpine(QXmlStreamReader& xml)
 	}
 }
 
-QString readerform::readFileContentFromZip(const QString& filePathInZip)
+void readerform::buildEntryIndex()
 {
+	zEntryIndex.clear();
+	zEntryIndexFolded.clear();
 	if (!zEpubFile || !zEpubFile->isOpen())
 	{
-		zLastError = tr("epub file is not open when read %1").arg(filePathInZip);
-		qWarning() << zLastError;
-		return QString();
+		return;
 	}
 
-	if (!zEpubFile->setCurrentFile(filePathInZip))
+	zEntryIndex.reserve(zEpubFile->getEntriesCount());
+	zEntryIndexFolded.reserve(zEpubFile->getEntriesCount());
+
+	for (bool more = zEpubFile->goToFirstFile(); more; more = zEpubFile->goToNextFile())
 	{
-		if (!zEpubFile->setCurrentFile(filePathInZip, QuaZip::csInsensitive))
+		const QString name = zEpubFile->getCurrentFileName();
+		const QuaZipFilePos pos = zEpubFile->getCurrentFilePosition();
+		zEntryIndex.insert(name, pos);
+
+		const QString folded = name.toCaseFolded();
+		if (!zEntryIndexFolded.contains(folded))//与setCurrentFile一致，同名时取第一个
 		{
-			zLastError = tr("could not set current file %1，error：%2").arg(filePathInZip).arg(zEpubFile->getZipError());
-			qWarning() << zLastError;
-			return QString();
+			zEntryIndexFolded.insert(folded, pos);
 		}
 	}
+}
 
-	QuaZipFile fileEntry(zEpubFile);
-	if (!fileEntry.open(QIODevice::ReadOnly))
+bool readerform::seekEntry(const QString& filePathInZip)
+{
+	if (!zEpubFile || !zEpubFile->isOpen())
 	{
-		zLastError = tr("could not open file：%1，error：%2").arg(filePathInZip).arg(fileEntry.getZipError());
-		qWarning() << zLastError;
-		return QString();
+		return false;
 	}
 
-	QByteArray data = fileEntry.readAll();
-	fileEntry.close();
-	return QString::fromUtf8(data);
+	auto it = zEntryIndex.constFind(filePathInZip);
+	if (it == zEntryIndex.constEnd())//精确匹配失败再按大小写不敏感查找
+	{
+		it = zEntryIndexFolded.constFind(filePathInZip.toCaseFolded());
+		if (it == zEntryIndexFolded.constEnd())
+		{
+			return false;
+		}
+	}
+
+	return zEpubFile->setCurrentFilePosition(it.value());
+}
+
+QString readerform::readFileContentFromZip(const QString& filePathInZip)
+{
+	return QString::fromUtf8(readBinaryFileContentFromZip(filePathInZip));
 }
 
 QByteArray readerform::readBinaryFileContentFromZip(const QString& filePathInZip)
 {
-	if (!zEpubFile || !zEpubFile->isOpen())
+	if (!isArchiveOpen())
 	{
 		zLastError = tr("epub file is not open when read %1").arg(filePathInZip);
 		qWarning() << zLastError;
 		return QByteArray();
 	}
 
-	if (!zEpubFile->setCurrentFile(filePathInZip))
+	if (zMappedArchive)//直接从映射区域读取，存储的文件不复制
 	{
-		if (!zEpubFile->setCurrentFile(filePathInZip, QuaZip::csInsensitive))
+		if (!zMappedArchive->contains(filePathInZip))
 		{
-			zLastError = tr("could not set current file %1，error：%2").arg(filePathInZip).arg(zEpubFile->getZipError());
+			zLastError = tr("could not find file %1 in epub").arg(filePathInZip);
 			qWarning() << zLastError;
 			return QByteArray();
 		}
+		return zMappedArchive->read(filePathInZip);
+	}
+
+	if (!seekEntry(filePathInZip))
+	{
+		zLastError = tr("could not set current file %1，error：%2").arg(filePathInZip).arg(zEpubFile->getZipError());
+		qWarning() << zLastError;
+		return QByteArray();
 	}
 
 	QuaZipFile fileEntry(zEpubFile);
@@ -764,15 +1222,15 @@ QByteArray readerform::readBinaryFileContentFromZip(const QString& filePathInZip
 		return QByteArray();
 	}
 
-	QByteArray data = fileEntry.readAll();
+	QByteArray data = readWholeEntry(fileEntry);
 	fileEntry.close();
 	return data;
 }
 
 bool readerform::parseNcxFile(const QString& ncxFilePathInZip)
 {
-	zNcxHrefToTitle.clear();
-	QString ncxContnet = readFileContentFromZip(ncxFilePathInZip);
+	zTocEntries.clear();
+	const QByteArray ncxContnet = readBinaryFileContentFromZip(ncxFilePathInZip);//由xml读取器按声明的编码解码，不先转成QString
 
 	if (ncxContnet.isEmpty())
 	{
@@ -788,15 +1246,14 @@ bool readerform::parseNcxFile(const QString& ncxFilePathInZip)
 
 		if (xml.isStartElement())
 		{
-			if (xml.name().toString() == "navMap")
+			if (xml.name() == QLatin1String("navMap"))
 			{
-				while (!(xml.isEndElement() && xml.name().toString() == "navMap") && !xml.atEnd())//调用辅助解析函数
+				while (!(xml.isEndElement() && xml.name() == QLatin1String("navMap")) && !xml.atEnd())//调用辅助解析函数
 				{
 					xml.readNext();
-					if (xml.isStartElement() && xml.name().toString() == "navPoint")
+					if (xml.isStartElement() && xml.name() == QLatin1String("navPoint"))
 					{
-						qDebug() << tr("ncx");
-						parseNcxNavPoint(xml);
+						parseNcxNavPoint(xml, -1, 0);
 					}
 				}
 			}
@@ -812,30 +1269,36 @@ bool readerform::parseNcxFile(const QString& ncxFilePathInZip)
 	return true;
 }
 
-void readerform::parseNcxNavPoint(QXmlStreamReader& xml)
+void readerform::parseNcxNavPoint(QXmlStreamReader& xml, int parent, int depth)
 {
-	if (!xml.isStartElement() || xml.name().toString() != "navPoint")
+	if (!xml.isStartElement() || xml.name() != QLatin1String("navPoint"))
 	{
 		return;
 	}
 
+	const int index = zTocEntries.size();//先占位，下级排在后面，保持先序
+	zTocEntries.append(epubTocEntry());
 	QString currentTitle;
 	QString	currentCotentSrc;
 
-	while (!(xml.isEndElement() && xml.name().toString() == "navPoint") && !xml.atEnd())
+	while (!xml.atEnd())
 	{
 		xml.readNext();
+		if (xml.isEndElement() && xml.name() == QLatin1String("navPoint"))//下级的结束标签已在下级中读掉
+		{
+			break;
+		}
 		if (xml.isStartElement())
 		{
-			QString tagName = xml.name().toString();
+			const QStringView tagName = xml.name();//只在读下一个记号之前使用
 
-			if (tagName == "navLabel")
+			if (tagName == QLatin1String("navLabel"))
 			{
-				while (!(xml.isEndElement() && xml.name().toString() == "navLabel"))
+				while (!(xml.isEndElement() && xml.name() == QLatin1String("navLabel")) && !xml.atEnd())
 				{
 					xml.readNext();
 
-					if (xml.isStartElement() && xml.name().toString() == "text")
+					if (xml.isStartElement() && xml.name() == QLatin1String("text"))
 					{
 						currentTitle = xml.readElementText().trimmed();
 						break;
@@ -843,9 +1306,9 @@ void readerform::parseNcxNavPoint(QXmlStreamReader& xml)
 				}
 			}
 
-			else if (tagName == "content")
+			else if (tagName == QLatin1String("content"))
 			{
-				currentCotentSrc = xml.attributes().value("src").toString();
+				currentCotentSrc = xml.attributes().value(QLatin1String("src")).toString();
 
 				if (xml.isStartElement())
 				{
@@ -853,20 +1316,148 @@ void readerform::parseNcxNavPoint(QXmlStreamReader& xml)
 				}
 			}
 
-			else if (tagName == "navPoint")
+			else if (tagName == QLatin1String("navPoint"))
 			{
-				parseNcxNavPoint(xml);
+				parseNcxNavPoint(xml, index, depth + 1);
 			}
 		}
 	}
 
-	if (!currentTitle.isEmpty() && !currentCotentSrc.isEmpty())
+	epubTocEntry& entry = zTocEntries[index];
+	entry.title = currentTitle;
+	entry.parent = parent;
+	entry.depth = depth;
+	if (!currentCotentSrc.isEmpty())
 	{
-		QString normalScr = normalHref(zOpfbasePath, currentCotentSrc);
+		entry.path = resolveOpfHref(currentCotentSrc);
+		const qsizetype anchorPos = currentCotentSrc.indexOf('#');
+		if (anchorPos >= 0)
+		{
+			entry.fragment = currentCotentSrc.mid(anchorPos + 1);
+		}
+	}
+}
+
+bool readerform::parseNavDocument(const QString& navFilePathInZip)
+{
+	const QByteArray navContent = readBinaryFileContentFromZip(navFilePathInZip);
+	if (navContent.isEmpty())
+	{
+		zLastError = tr("navigation document is empty:%1").arg(navFilePathInZip);
+		return false;
+	}
+
+	//导航文档中的href相对于它自己所在的目录
+	const QString navDir = navFilePathInZip.left(navFilePathInZip.lastIndexOf('/') + 1);
+	const QLatin1String opsNamespaceUri("http://www.idpf.org/2007/ops");
+	const qsizetype startSize = zTocEntries.size();
 
-		if (!normalScr.isEmpty())
+	//先找epub:type含toc的nav，没有时退而用第一个nav
+	for (int pass = 0; pass < 2 && zTocEntries.isEmpty(); ++pass)
+	{
+		QXmlStreamReader xml(navContent);
+		bool inToc = false;
+		while (!xml.atEnd() && !xml.hasError())
 		{
-			zNcxHrefToTitle[normalScr] = currentTitle;
+			xml.readNext();
+			if (!xml.isStartElement())
+			{
+				if (inToc && xml.isEndElement() && xml.name() == QLatin1String("nav"))
+				{
+					break;//只取一个nav
+				}
+				continue;
+			}
+
+			if (!inToc && xml.name() == QLatin1String("nav"))
+			{
+				const QXmlStreamAttributes attributes = xml.attributes();
+				QStringView type = attributes.value(opsNamespaceUri, QLatin1String("type"));
+				if (type.isNull())
+				{
+					type = attributes.value(QLatin1String("epub:type"));//没有声明命名空间的文档
+				}
+				inToc = pass == 1 || type.split(' ', Qt::SkipEmptyParts).contains(QLatin1String("toc"));
+			}
+			else if (inToc && xml.name() == QLatin1String("ol"))
+			{
+				parseNavList(xml, navDir, -1, 0);
+			}
+		}
+
+		if (xml.hasError())
+		{
+			zLastError = tr("xml error in navigation document(%1):%2").arg(navFilePathInZip).arg(xml.errorString());
+			zTocEntries.resize(startSize);//丢掉出错前解析的部分，退回到按spine生成目录
+			return false;
 		}
 	}
-}
\ No newline at end of file
+	return true;
+}
+
+void readerform::parseNavList(QXmlStreamReader& xml, const QString& navDir, int parent, int depth)
+{
+	while (!xml.atEnd())
+	{
+		xml.readNext();
+		if (xml.isEndElement() && xml.name() == QLatin1String("ol"))
+		{
+			break;
+		}
+		if (xml.isStartElement() && xml.name() == QLatin1String("li"))
+		{
+			parseNavItem(xml, navDir, parent, depth);
+		}
+	}
+}
+
+void readerform::parseNavItem(QXmlStreamReader& xml, const QString& navDir, int parent, int depth)
+{
+	const int index = zTocEntries.size();//先占位，下级排在后面，保持先序
+	zTocEntries.append(epubTocEntry());
+	QString title;
+	QString href;
+
+	while (!xml.atEnd())
+	{
+		xml.readNext();
+		if (xml.isEndElement() && xml.name() == QLatin1String("li"))//下级的结束标签已在下级中读掉
+		{
+			break;
+		}
+		if (!xml.isStartElement())
+		{
+			continue;
+		}
+
+		const QStringView tagName = xml.name();//只在读下一个记号之前使用
+		if (tagName == QLatin1String("a"))
+		{
+			href = xml.attributes().value(QLatin1String("href")).toString();
+			title = xml.readElementText(QXmlStreamReader::IncludeChildElements).simplified();
+		}
+		else if (tagName == QLatin1String("span"))//没有链接的分组标题
+		{
+			title = xml.readElementText(QXmlStreamReader::IncludeChildElements).simplified();
+		}
+		else if (tagName == QLatin1String("ol"))
+		{
+			parseNavList(xml, navDir, index, depth + 1);
+		}
+	}
+
+	epubTocEntry& entry = zTocEntries[index];
+	entry.title = title;
+	entry.parent = parent;
+	entry.depth = depth;
+	if (!href.isEmpty())
+	{
+		//与opf同目录时复用manifest中已算出的路径
+		entry.path = navDir == zOpfbasePath ? resolveOpfHref(href) : normalHref(navDir, href);
+		const qsizetype anchorPos = href.indexOf('#');
+		if (anchorPos >= 0)
+		{
+			entry.fragment = href.mid(anchorPos + 1);
+		}
+	}
+}
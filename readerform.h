@@ -2,11 +2,21 @@
 
 #include <QObject>
 #include <QMap>
+#include <QHash>
 #include <QString>
 #include <QStringList>
 #include <QVariantMap>
+#include <QCache>
+#include <QMutex>
+#include <QSet>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QPromise>
+#include <memory>
 #include "QuaZip-Qt6-1.5/quazip/quazip.h"
 #include "QuaZip-Qt6-1.5/quazip/quazipfile.h"
+#include "epubmappedarchive.h"
+#include "epubtableofcontents.h"
 #include <QXmlStreamReader>
 #include <QFileInfo>
 #include <QUrl>
@@ -14,6 +24,7 @@
 class QuaZip;
 class QuaZipFile;
 class QXmlStreamReader;
+struct epubMetadataSnapshot;
 
 // 结构体用于存储 manifest 中的项目信息
 struct epubManifestItem
@@ -22,6 +33,8 @@ struct epubManifestItem
 	QString href;
 	QString mediaType;
 	QString fallback;
+	QString properties;//epub3的属性，如cover-image、nav
+	QString path;//解析manifest时由href算出的zip内路径，查找时不再解析url
 };
 //结构体用来存储 spine中的item信息
 struct SpineItem
@@ -30,6 +43,63 @@ struct SpineItem
 	bool linear = true;
 };
 
+//读取zip的方式
+enum epubArchiveBackend
+{
+	QUAZIP_ARCHIVE,//通过QuaZip按文件读取
+	MAPPED_ARCHIVE //把整个文件映射到内存
+};
+
+//书籍的只读快照，后台线程通过它读取zip内容而不触碰readerform本身
+struct epubReadSnapshot
+{
+	QString epubFilePath;
+	QString opfBasePath;
+	QMap<QString, epubManifestItem> manifestItem;
+	QHash<QString, QuaZipFilePos> entryIndex;
+	QHash<QString, QuaZipFilePos> entryIndexFolded;
+	std::shared_ptr<const epubMappedArchive> mappedArchive;//使用映射方式时不为空
+};
+
+//只在单个工作线程内使用，持有独立的QuaZip句柄
+class epubEntryReader
+{
+public:
+	explicit epubEntryReader(const epubReadSnapshot& snapshot);
+	~epubEntryReader();
+	//按zip内路径读取
+	QByteArray read(const QString& filePathInZip);
+	//按manifest id读取
+	QByteArray readContentById(const QString& itemId);
+
+private:
+	Q_DISABLE_COPY(epubEntryReader)
+	epubReadSnapshot zSnapshot;
+	QuaZip* zZip;
+};
+
+//已解压章节的LRU缓存，按字节计算开销，界面线程和后台线程共享
+struct epubContentCache
+{
+	static constexpr qsizetype defaultBudget = 32 * 1024 * 1024;//默认32MB
+
+	QMutex mutex;
+	quint64 generation = 0;//每次关闭书籍递增，用于丢弃过期的预读结果
+	QSet<QString> pending;//正在预读的id
+	QCache<QString, QString> chapters{ defaultBudget };//id->章节内容
+	quint64 hits = 0;//命中次数
+	quint64 misses = 0;//未命中次数
+};
+
+//章节缓存的统计信息
+struct epubCacheStats
+{
+	quint64 hits = 0;
+	quint64 misses = 0;
+	qsizetype usedBytes = 0;
+	qsizetype budgetBytes = 0;
+};
+
 
 class readerform  : public QObject
 {
@@ -39,27 +109,59 @@ public:
 	readerform(QObject *parent);
 	~readerform();
 	//打开epub文件
-	bool openEpub(const QString &filePath);
+	bool openEpub(const QString &filePath, epubArchiveBackend backend = QUAZIP_ARCHIVE);
+	//在后台线程打开epub，完成后发出openFinished，成功时才替换当前书籍
+	QFuture<bool> openEpubAsync(const QString& filePath, epubArchiveBackend backend = QUAZIP_ARCHIVE);
+	//取消正在进行的后台打开
+	void cancelOpen();
+	//是否正在后台打开
+	bool isOpening() const;
 	//关闭epub文件
 	void closeEpub();
-	//获取目录，id->href
+	//获取目录，章节id->标题
 	QMap<QString, QString> getTableofContent() const;
+	//获取目录对象，打开时建立，保留层级；没有打开书籍时为空目录，不会是空指针
+	std::shared_ptr<const epubTableOfContents> getTableOfContents() const;
 	//获取章节,id->content
 	QString getContentById(const QString& itemId);
+	//获取章节在zip中的路径
+	QString getContentPathById(const QString& itemId) const;
+	//读取图片等资源，映射方式下存储的文件返回映射区域的切片，不要在closeEpub之后持有
+	QByteArray getResourceByPath(const QString& filePathInZip);
 	//获取图片路径
 	QString getCoverImagePath() const;
 	//获取元数据
 	QVariantMap getMetaDate() const;
+	//opf中package的unique-identifier所指的dc:identifier，没有时取第一个dc:identifier
+	QString uniqueIdentifier() const;
+	//zip中央目录的原始字节，只在映射方式打开时有，是映射区域的切片，不要在closeEpub之后持有
+	QByteArray centralDirectory() const;
 	//获取错误信息
 	QString getLastError() const;
 	//获取spineItem
 	QList<SpineItem> getSpineItem() const;
 	//获取ncx在manife中的id
 	QString getNcxItemId() const;
+	//在后台线程预读章节，结果供getContentById直接使用
+	void prefetchContent(const QStringList& itemIds);
+	//设置章节缓存的内存上限(字节)
+	void setContentCacheBudget(qsizetype bytes);
+	//获取章节缓存的统计信息
+	epubCacheStats getContentCacheStats() const;
+	//获取当前书籍的只读快照
+	epubReadSnapshot readSnapshot() const;
+	//规范href路径
+	static QString normalHref(const QString& opfBase, const QString& relHref);
 
+signals:
+	//后台打开进度，0-100
+	void openProgress(int percent);
+	//后台打开结束
+	void openFinished(bool success);
 
 private:
 	QuaZip* zEpubFile;
+	std::shared_ptr<epubMappedArchive> zMappedArchive;//映射方式打开时使用，与zEpubFile二选一
 	QString zEpubFilePath;//epub文件路径
 	QString zOpfFilePath;//.opf在zip中的路径
 	QString zOpfbasePath;//.opf文件所在目录的路径
@@ -68,26 +170,60 @@ private:
 	QList<SpineItem> zSpineItem;// 阅读顺序 (item ID 列表)
 	QString zNcxItemId;//存储spine中的ncx属性
 
-	QMap<QString, QString>zNcxHrefToTitle;//href到title的映射
+	QList<epubTocEntry> zTocEntries;//ncx中的目录项，先序排列，保留层级
+	std::shared_ptr<const epubTableOfContents> zTableOfContents;//由目录项和spine建立，打开后不再改变
+	QHash<QString, QString> zManifestPathByHref;//解析期间使用，manifest中的href->zip内路径，同一路径只存一份
+
+	QHash<QString, QuaZipFilePos> zEntryIndex;//zip内路径->中央目录位置
+	QHash<QString, QuaZipFilePos> zEntryIndexFolded;//大小写折叠后的路径->中央目录位置
+
+	std::shared_ptr<epubContentCache> zContentCache;//章节缓存
+
+	QFutureWatcher<bool>* zOpenWatcher;//当前的后台打开任务
 
 	QVariantMap zMetadata;// 存储解析到的元数据
 
 	QString zLastError;
 
+	//打开epub，promise不为空时汇报进度并响应取消
+	bool openEpubStaged(const QString& filePath, epubArchiveBackend backend, QPromise<bool>* promise);
+	//zip是否已打开(任一方式)
+	bool isArchiveOpen() const;
+	//接管另一个解析器的书籍状态
+	void adoptState(readerform& other);
+	//中央目录的哈希，用于判断解析结果缓存是否有效
+	QByteArray centralDirectoryHash() const;
+	//当前的解析结果
+	epubMetadataSnapshot metadataSnapshot() const;
+	//从缓存恢复解析结果
+	void restoreMetadata(epubMetadataSnapshot& snapshot);
+
 	// 内部解析函数
 	bool parseContainerXml();
-	QString findOpfFilePath(QuaZipFile& containerFileStream);
+	QString findOpfFilePath(const QByteArray& containerData);
 	bool parseOpfFile();
 	void parseOpfMetadata(QXmlStreamReader& xml);
 	void parseManifest(QXmlStreamReader& xml);
 	void parseSpine(QXmlStreamReader& xml);
 	//解析ncx文件
 	bool parseNcxFile(const QString& ncxFilePathInZip);
-	void parseNcxNavPoint(QXmlStreamReader& xml);
+	//解析一个navPoint及其下级，parent为上一级在zTocEntries中的下标
+	void parseNcxNavPoint(QXmlStreamReader& xml, int parent, int depth);
+	//解析epub3的导航文档，结果与ncx一样放入zTocEntries
+	bool parseNavDocument(const QString& navFilePathInZip);
+	//解析导航文档中的一个ol及其下级，navDir为导航文档所在目录
+	void parseNavList(QXmlStreamReader& xml, const QString& navDir, int parent, int depth);
+	//解析ol中的一个li
+	void parseNavItem(QXmlStreamReader& xml, const QString& navDir, int parent, int depth);
+	//相对opf的href对应的zip内路径，manifest中出现过的href直接复用已算出的字符串
+	QString resolveOpfHref(const QString& href);
+
+	//遍历一次中央目录建立索引
+	void buildEntryIndex();
+	//通过索引定位zip中的文件
+	bool seekEntry(const QString& filePathInZip);
 
 	// 从 ZIP 中读取文件内容
 	QString readFileContentFromZip(const QString& filePathInZip);
 	QByteArray readBinaryFileContentFromZip(const QString& filePathInZip);
-	//规范href路径
-	QString normalHref(const QString& opfBase, const QString& relHref) const;
 };
\ No newline at end of file